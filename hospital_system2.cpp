@@ -7,20 +7,69 @@
 #include <algorithm>
 #include <iomanip>
 #include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <deque>
 #include <cstring>
 #include <cstddef>
 #include <cctype>
 #include <stdexcept>
+#include <mutex>
 #include <utility>
 #include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <climits>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HMS_HAVE_AVX2 1
+#else
+#define HMS_HAVE_AVX2 0
+#endif
+#ifdef _WIN32
+// keeps windows.h from defining min/max macros, which break std::max,
+// numeric_limits<T>::max() and the max() members below
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <csignal>
+#include <cerrno>
+#endif
 
 using namespace std;
 struct CaseInsensitiveHash {
     size_t operator()(const string& key) const {
-        string lowercase = key;
-        transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
-                 [](unsigned char c){ return tolower(c); });
-        return hash<string>{}(lowercase);
+        // FNV-1a over the folded bytes, without building a lowercase copy
+        size_t hash = static_cast<size_t>(14695981039346656037ULL);
+        for (unsigned char c : key) {
+            hash ^= static_cast<size_t>(tolower(c));
+            hash *= static_cast<size_t>(1099511628211ULL);
+        }
+        return hash;
     }
 };
 struct CaseInsensitiveEqual {
@@ -33,15 +82,192 @@ struct CaseInsensitiveEqual {
         return true;
     }
 };
+// Non-owning view of a run of characters inside a larger buffer.
+struct StrRef {
+    const char* data;
+    size_t size;
+
+    StrRef() : data(nullptr), size(0) {}
+    StrRef(const char* data, size_t size) : data(data), size(size) {}
+    StrRef(const string& text) : data(text.data()), size(text.size()) {}
+
+    bool empty() const {
+        return size == 0;
+    }
+
+    string str() const {
+        return string(data, size);
+    }
+};
+
+inline uint64_t fnv1a(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Read-only view of a whole file, memory-mapped where the platform allows it.
+class MappedFile {
+private:
+    const char* base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fd;
+#endif
+
+public:
+    MappedFile() : base(nullptr), length(0)
+#ifdef _WIN32
+        , fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#else
+        , fd(-1)
+#endif
+    {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+        if (length == 0) {
+            return true;
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL) {
+            close();
+            return false;
+        }
+        base = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length == 0) {
+            return true;
+        }
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        base = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mappingHandle != NULL) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap(const_cast<char*>(base), length);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    const char* data() const {
+        return base;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Allocation-free equivalent of stoi: optional leading whitespace and sign,
+// at least one digit, anything after the digits is ignored.
+inline bool parseInt(StrRef text, int& value) {
+    size_t i = 0;
+    while (i < text.size && isspace(static_cast<unsigned char>(text.data[i]))) i++;
+    bool negative = false;
+    if (i < text.size && (text.data[i] == '-' || text.data[i] == '+')) {
+        negative = text.data[i] == '-';
+        i++;
+    }
+    if (i >= text.size || !isdigit(static_cast<unsigned char>(text.data[i]))) {
+        return false;
+    }
+    long long result = 0;
+    while (i < text.size && isdigit(static_cast<unsigned char>(text.data[i]))) {
+        result = result * 10 + (text.data[i] - '0');
+        if (result > static_cast<long long>(INT_MAX) + 1) {
+            return false;
+        }
+        i++;
+    }
+    if (negative) result = -result;
+    if (result > INT_MAX || result < INT_MIN) {
+        return false;
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+// A calendar date packed into a single YYYYMMDD integer, 0 when unset.
+// Only valid dates are ever stored, so ordering is a plain integer
+// comparison and isValid() is a test against zero.
 class Date {
 private:
-    int year, month, day;
+    uint32_t key;
+
+    static constexpr bool isLeapYear(int year) {
+        return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+    }
+
+    static constexpr int daysInMonth(int month, int year) {
+        return month == 2 ? (isLeapYear(year) ? 29 : 28)
+             : (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+    }
+
+    static constexpr bool isValidCivil(int day, int month, int year) {
+        return year >= 1900 && year <= 2100 && month >= 1 && month <= 12 &&
+               day >= 1 && day <= daysInMonth(month, year);
+    }
+
+    static constexpr uint32_t packCivil(int day, int month, int year) {
+        return isValidCivil(day, month, year)
+            ? static_cast<uint32_t>(year * 10000 + month * 100 + day) : 0;
+    }
 
 public:
-    Date() : year(0), month(0), day(0) {}
+    constexpr Date() : key(0) {}
+
+    // An invalid combination yields an unset date.
+    constexpr Date(int day, int month, int year) : key(packCivil(day, month, year)) {}
     
-    Date(const string& dateStr) {
-        year = month = day = 0;
+    Date(const string& dateStr) : key(0) {
         if (dateStr.empty()) {
             return;
         }
@@ -54,73 +280,549 @@ public:
             throw invalid_argument("Invalid date format. Please use '-' as delimiter");
         }
         
-        string dayStr = dateStr.substr(0, 2);
-        string monthStr = dateStr.substr(3, 2);
-        string yearStr = dateStr.substr(6, 4);
-        
-        if (!isdigit(dayStr[0]) || !isdigit(dayStr[1]) ||
-            !isdigit(monthStr[0]) || !isdigit(monthStr[1]) ||
-            !isdigit(yearStr[0]) || !isdigit(yearStr[1]) ||
-            !isdigit(yearStr[2]) || !isdigit(yearStr[3])) {
-            throw invalid_argument("Date components must be numbers");
+        static const int digitPositions[] = {0, 1, 3, 4, 6, 7, 8, 9};
+        for (int pos : digitPositions) {
+            if (!isdigit(static_cast<unsigned char>(dateStr[pos]))) {
+                throw invalid_argument("Date components must be numbers");
+            }
         }
         
-        day = stoi(dayStr);
-        month = stoi(monthStr);
-        year = stoi(yearStr);
-        
-        if (!isValid()) {
+        if (!parse(StrRef(dateStr.data(), dateStr.size()), *this)) {
             throw invalid_argument("Invalid date. Please enter a valid date");
         }
     }
 
+    // Non-throwing DD-MM-YYYY parser used by the bulk loader. Accepts the
+    // same inputs as the string constructor; empty text yields an unset date.
+    static bool parse(StrRef text, Date& date) {
+        date = Date();
+        if (text.empty()) {
+            return true;
+        }
+        if (text.size != 10 || text.data[2] != '-' || text.data[5] != '-') {
+            return false;
+        }
+        static const int digitPositions[] = {0, 1, 3, 4, 6, 7, 8, 9};
+        for (int pos : digitPositions) {
+            if (!isdigit(static_cast<unsigned char>(text.data[pos]))) {
+                return false;
+            }
+        }
+        const char* p = text.data;
+        int day = (p[0] - '0') * 10 + (p[1] - '0');
+        int month = (p[3] - '0') * 10 + (p[4] - '0');
+        int year = (p[6] - '0') * 1000 + (p[7] - '0') * 100 + (p[8] - '0') * 10 + (p[9] - '0');
+        date = Date(day, month, year);
+        return date.isValid();
+    }
+
+    constexpr bool isSet() const {
+        return key != 0;
+    }
+
+    static Date today() {
+        time_t now = time(nullptr);
+        tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return Date(local.tm_mday, local.tm_mon + 1, local.tm_year + 1900);
+    }
+
+    constexpr int getDay() const {
+        return static_cast<int>(key % 100);
+    }
+
+    constexpr int getMonth() const {
+        return static_cast<int>(key / 100 % 100);
+    }
+
+    constexpr int getYear() const {
+        return static_cast<int>(key / 10000);
+    }
+
+    // YYYYMMDD key; 0 for an unset date. Ordering matches operator<.
+    constexpr uint32_t packed() const {
+        return key;
+    }
+
+    // Keys that do not decode to a valid date yield an unset date.
+    static Date fromPacked(uint32_t key) {
+        return Date(static_cast<int>(key % 100), static_cast<int>(key / 100 % 100),
+                    static_cast<int>(key / 10000));
+    }
+
+    // Days since 1970-01-01 (proleptic Gregorian).
+    int dayNumber() const {
+        int year = getYear();
+        int month = getMonth();
+        year -= month <= 2;
+        int era = (year >= 0 ? year : year - 399) / 400;
+        int yearOfEra = year - era * 400;
+        int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + getDay() - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+
+    static Date fromDayNumber(int days) {
+        days += 719468;
+        int era = (days >= 0 ? days : days - 146096) / 146097;
+        int dayOfEra = days - era * 146097;
+        int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int shiftedMonth = (5 * dayOfYear + 2) / 153;
+        int day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+        int month = shiftedMonth + (shiftedMonth < 10 ? 3 : -9);
+        int year = yearOfEra + era * 400 + (month <= 2);
+        return Date(day, month, year);
+    }
+
+    // Number of days from this date to other (negative if other is earlier).
+    int daysUntil(const Date& other) const {
+        return other.dayNumber() - dayNumber();
+    }
+
+    Date addDays(int days) const {
+        return fromDayNumber(dayNumber() + days);
+    }
+
+    // Writes DD-MM-YYYY into buffer (at least 10 bytes) and returns the
+    // number of characters written; 0 for an unset date.
+    size_t format(char* buffer) const {
+        if (key == 0) {
+            return 0;
+        }
+        int day = getDay();
+        int month = getMonth();
+        int year = getYear();
+        buffer[0] = static_cast<char>('0' + day / 10);
+        buffer[1] = static_cast<char>('0' + day % 10);
+        buffer[2] = '-';
+        buffer[3] = static_cast<char>('0' + month / 10);
+        buffer[4] = static_cast<char>('0' + month % 10);
+        buffer[5] = '-';
+        buffer[6] = static_cast<char>('0' + year / 1000);
+        buffer[7] = static_cast<char>('0' + year / 100 % 10);
+        buffer[8] = static_cast<char>('0' + year / 10 % 10);
+        buffer[9] = static_cast<char>('0' + year % 10);
+        return 10;
+    }
+
     string toString() const {
-        if (year == 0 && month == 0 && day == 0) {
+        if (key == 0) {
             return "Not set";
         }
-        stringstream ss;
-        ss << setfill('0') << setw(2) << day << "-"
-           << setfill('0') << setw(2) << month << "-"
-           << setfill('0') << setw(4) << year;
-        return ss.str();
+        char buffer[10];
+        return string(buffer, format(buffer));
     }
-        bool operator<(const Date& other) const {
-        if (year != other.year) return year < other.year;
-        if (month != other.month) return month < other.month;
-        return day < other.day;
+
+    constexpr bool operator<(const Date& other) const {
+        return key < other.key;
     }
 
-    bool operator<=(const Date& other) const {
-        return *this < other || *this == other;
+    constexpr bool operator<=(const Date& other) const {
+        return key <= other.key;
     }
 
-    bool operator>(const Date& other) const {
-        return !(*this <= other);
+    constexpr bool operator>(const Date& other) const {
+        return key > other.key;
     }
 
-    bool operator>=(const Date& other) const {
-        return !(*this < other);
+    constexpr bool operator>=(const Date& other) const {
+        return key >= other.key;
     }
 
-    bool operator==(const Date& other) const {
-        return year == other.year && month == other.month && day == other.day;
+    constexpr bool operator==(const Date& other) const {
+        return key == other.key;
     }
-        bool isValid() const {
-        if (year < 1900 || year > 2100) return false;
-        if (month < 1 || month > 12) return false;
-        
-        const int daysInMonth[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-        int maxDays = daysInMonth[month];
-        
-        if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || (year % 400 == 0))) {
-            maxDays = 29;
+
+    constexpr bool isValid() const {
+        return key != 0;
+    }
+};
+
+inline string foldCase(const string& value) {
+    string folded = value;
+    transform(folded.begin(), folded.end(), folded.begin(),
+              [](unsigned char c){ return tolower(c); });
+    return folded;
+}
+
+inline string foldCase(StrRef value) {
+    string folded(value.size, '\0');
+    transform(value.data, value.data + value.size, folded.begin(),
+              [](unsigned char c){ return tolower(c); });
+    return folded;
+}
+
+// Dictionary encoding for low-cardinality columns. Each distinct value gets
+// a dense code; keys are case-folded once at intern time and the first
+// spelling seen is the one displayed. intern() and find() lock, so loader
+// threads can intern concurrently. value() does not: it sits on every
+// displayed row, so callers must not run it alongside intern(). Readers
+// hold the system's shared lock and every intern() outside a load runs
+// under the exclusive one.
+class StringDictionary {
+private:
+    deque<string> values;   // deque keeps handed-out references valid as it grows
+    unordered_map<string, uint32_t> codes;
+    mutable mutex lock;
+
+public:
+    uint32_t intern(const string& value) {
+        string key = foldCase(value);
+        lock_guard<mutex> guard(lock);
+        auto it = codes.find(key);
+        if (it != codes.end()) {
+            return it->second;
         }
-        
-        if (day < 1 || day > maxDays) return false;
+        uint32_t code = static_cast<uint32_t>(values.size());
+        values.push_back(value);
+        codes.emplace(key, code);
+        return code;
+    }
+
+    bool find(const string& value, uint32_t& code) const {
+        string key = foldCase(value);
+        lock_guard<mutex> guard(lock);
+        auto it = codes.find(key);
+        if (it == codes.end()) {
+            return false;
+        }
+        code = it->second;
         return true;
     }
+
+    const string& value(uint32_t code) const {
+        return values[code];
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return values.size();
+    }
+};
+
+// Department and condition dictionaries of one dataset. Each HospitalSystem
+// owns its own, so codes stay dense for that dataset and per-code arrays are
+// sized by the values it actually holds.
+struct CodeDictionaries {
+    StringDictionary departments;
+    StringDictionary conditions;
+};
+
+// Per-thread front for a StringDictionary keyed on the exact bytes, so the
+// loader can intern StrRef fields without allocating or taking the
+// dictionary lock on every row.
+class InternCache {
+private:
+    StringDictionary& dictionary;
+    unordered_map<uint64_t, pair<string, uint32_t>> entries;
+
+public:
+    explicit InternCache(StringDictionary& dictionary) : dictionary(dictionary) {}
+
+    uint32_t intern(StrRef value) {
+        uint64_t key = fnv1a(value.data, value.size);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.first.size() == value.size &&
+            memcmp(it->second.first.data(), value.data, value.size) == 0) {
+            return it->second.second;
+        }
+        string text = value.str();
+        uint32_t code = dictionary.intern(text);
+        entries[key] = make_pair(text, code);
+        return code;
+    }
+};
+
+// InternCaches over both dictionaries of a dataset, for one loader thread.
+struct CodeCache {
+    CodeDictionaries& codes;
+    InternCache departments;
+    InternCache conditions;
+
+    explicit CodeCache(CodeDictionaries& codes)
+        : codes(codes), departments(codes.departments), conditions(codes.conditions) {}
+};
+
+// Bump allocator for the free text of stored records (names and medical
+// histories). Text is copied into large blocks that never move, so a record
+// holds a plain StrRef into the arena instead of owning two strings. Edits
+// and deletes hand their bytes back to a free list per rounded size, which
+// later stores of that size reuse; longer text is only reclaimed when the
+// arena is rebuilt. Dropping the arena frees a few blocks rather than one
+// allocation per string.
+class TextArena {
+public:
+    static const size_t granule = 8;
+    static const size_t minBlockBytes = 4096;
+    static const size_t maxBlockBytes = 1 << 20;
+    static const size_t maxRecycledBytes = 256;
+
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char* cursor;
+    size_t remaining;
+    vector<vector<char*>> freeLists;  // indexed by rounded size / granule
+    size_t reservedBytes;
+    size_t usedBytes;
+
+    static size_t rounded(size_t size) {
+        return (size + granule - 1) / granule * granule;
+    }
+
+    char* allocate(size_t size) {
+        if (size > remaining) {
+            // blocks double up to maxBlockBytes; text that would fill most of
+            // a block gets one of its own and the current block stays open
+            size_t blockSize = reservedBytes < minBlockBytes ? minBlockBytes
+                             : reservedBytes > maxBlockBytes ? maxBlockBytes : reservedBytes;
+            if (size > blockSize / 2) {
+                blocks.emplace_back(new char[size]);
+                reservedBytes += size;
+                return blocks.back().get();
+            }
+            blocks.emplace_back(new char[blockSize]);
+            reservedBytes += blockSize;
+            cursor = blocks.back().get();
+            remaining = blockSize;
+        }
+        char* result = cursor;
+        cursor += size;
+        remaining -= size;
+        return result;
+    }
+
+public:
+    TextArena()
+        : cursor(nullptr), remaining(0), freeLists(maxRecycledBytes / granule + 1),
+          reservedBytes(0), usedBytes(0) {}
+
+    StrRef store(StrRef text) {
+        if (text.size == 0) {
+            return StrRef("", 0);
+        }
+        size_t size = rounded(text.size);
+        char* target;
+        if (size <= maxRecycledBytes && !freeLists[size / granule].empty()) {
+            target = freeLists[size / granule].back();
+            freeLists[size / granule].pop_back();
+        } else {
+            target = allocate(size);
+        }
+        memcpy(target, text.data, text.size);
+        usedBytes += size;
+        return StrRef(target, text.size);
+    }
+
+    // text must have come from store() on this arena (or one it adopted).
+    void release(StrRef text) {
+        if (text.size == 0) {
+            return;
+        }
+        size_t size = rounded(text.size);
+        usedBytes -= size;
+        if (size <= maxRecycledBytes) {
+            freeLists[size / granule].push_back(const_cast<char*>(text.data));
+        }
+    }
+
+    // Takes over other's blocks, e.g. from a loader thread; text stored in
+    // either arena stays valid. other is left empty.
+    void adopt(TextArena& other) {
+        for (auto& block : other.blocks) {
+            blocks.push_back(move(block));
+        }
+        for (size_t i = 0; i < freeLists.size(); i++) {
+            freeLists[i].insert(freeLists[i].end(), other.freeLists[i].begin(), other.freeLists[i].end());
+        }
+        reservedBytes += other.reservedBytes;
+        usedBytes += other.usedBytes;
+        other.clear();
+    }
+
+    void clear() {
+        blocks.clear();
+        for (auto& list : freeLists) {
+            list.clear();
+        }
+        cursor = nullptr;
+        remaining = 0;
+        reservedBytes = 0;
+        usedBytes = 0;
+    }
+
+    void swap(TextArena& other) {
+        blocks.swap(other.blocks);
+        std::swap(cursor, other.cursor);
+        std::swap(remaining, other.remaining);
+        freeLists.swap(other.freeLists);
+        std::swap(reservedBytes, other.reservedBytes);
+        std::swap(usedBytes, other.usedBytes);
+    }
+
+    size_t bytesReserved() const {
+        return reservedBytes;
+    }
+
+    size_t bytesUsed() const {
+        return usedBytes;
+    }
 };
 
+// Appends the decimal form of value without going through a stream.
+inline void appendInt(string& out, long long value) {
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* cursor = end;
+    unsigned long long magnitude = value < 0 ? 0ULL - static_cast<unsigned long long>(value)
+                                             : static_cast<unsigned long long>(value);
+    do {
+        *--cursor = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--cursor = '-';
+    }
+    out.append(cursor, end - cursor);
+}
+
+inline void appendDate(string& out, const Date& date) {
+    char buffer[10];
+    out.append(buffer, date.format(buffer));
+}
+
+inline void appendDisplayDate(string& out, const Date& date) {
+    if (date.isValid()) {
+        appendDate(out, date);
+    } else {
+        out += "Not set";
+    }
+}
+
+inline void appendJSONString(string& out, StrRef text) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (size_t i = 0; i < text.size; i++) {
+        char c = text.data[i];
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if (byte < 0x20) {
+            out += "\\u00";
+            out += hex[byte >> 4];
+            out += hex[byte & 0xF];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+inline void appendJSONDate(string& out, const Date& date) {
+    if (!date.isValid()) {
+        out += "null";
+        return;
+    }
+    out += '"';
+    appendDate(out, date);
+    out += '"';
+}
+
+inline void appendText(string& out, StrRef text) {
+    out.append(text.data, text.size);
+}
+
+// Row formatters shared by Patient and the stored PatientRecord, which hold
+// the same fields with the text as string or as an arena StrRef, and the
+// department and condition as string or as a dictionary code; departmentOf
+// and conditionOf read either.
+class Patient;
+class PatientRecord;
+const string& departmentOf(const Patient& patient);
+const string& conditionOf(const Patient& patient);
+const string& departmentOf(const PatientRecord& record);
+const string& conditionOf(const PatientRecord& record);
+
+// Appends the multi-line block printed by display(); unset dates read
+// "Not set".
+template <typename Record>
+void appendRecordDisplay(string& out, const Record& record) {
+    static const char rule[] = "-------------------------------------\n";
+    out += rule;
+    out += "ID: ";
+    appendInt(out, record.id);
+    out += "\nName: ";
+    appendText(out, record.name);
+    out += "\nMedical History: ";
+    appendText(out, record.medicalHistory);
+    out += "\nDepartment: ";
+    out += departmentOf(record);
+    out += "\nCondition: ";
+    out += conditionOf(record);
+    out += "\nAdmission Date: ";
+    appendDisplayDate(out, record.admissionDate);
+    out += "\nDischarge Date: ";
+    appendDisplayDate(out, record.dischargeDate);
+    out += "\nRoom Number: ";
+    appendInt(out, record.roomNumber);
+    out += '\n';
+    out += rule;
+}
+
+// Appends the CSV row (without newline); unset dates are empty.
+template <typename Record>
+void appendRecordCSV(string& out, const Record& record) {
+    appendInt(out, record.id);
+    out += ',';
+    appendText(out, record.name);
+    out += ',';
+    appendText(out, record.medicalHistory);
+    out += ',';
+    out += departmentOf(record);
+    out += ',';
+    out += conditionOf(record);
+    out += ',';
+    appendDate(out, record.admissionDate);
+    out += ',';
+    appendDate(out, record.dischargeDate);
+    out += ',';
+    appendInt(out, record.roomNumber);
+}
+
+// Appends one JSON object (without newline) with the keys read by
+// parsePatientJson; unset dates are null.
+template <typename Record>
+void appendRecordJSON(string& out, const Record& record) {
+    out += "{\"id\":";
+    appendInt(out, record.id);
+    out += ",\"name\":";
+    appendJSONString(out, record.name);
+    out += ",\"medicalHistory\":";
+    appendJSONString(out, record.medicalHistory);
+    out += ",\"department\":";
+    appendJSONString(out, departmentOf(record));
+    out += ",\"condition\":";
+    appendJSONString(out, conditionOf(record));
+    out += ",\"admissionDate\":";
+    appendJSONDate(out, record.admissionDate);
+    out += ",\"dischargeDate\":";
+    appendJSONDate(out, record.dischargeDate);
+    out += ",\"roomNumber\":";
+    appendInt(out, record.roomNumber);
+    out += '}';
+}
+
 class Patient {
 public:
     int id;
@@ -132,730 +834,7377 @@ public:
     Date dischargeDate;
     int roomNumber;
 
+    // Placeholder to be assigned over, e.g. by HospitalSystem::getPatient.
+    Patient() : id(0), roomNumber(0) {}
+
     Patient(int id, const string& name, const string& medicalHistory, const string& department, 
             const string& condition, const string& admissionDateStr, const string& dischargeDateStr, int roomNumber)
         : id(id), name(name), medicalHistory(medicalHistory), department(department),
           condition(condition), admissionDate(admissionDateStr), dischargeDate(dischargeDateStr),
           roomNumber(roomNumber) {}
 
+    Patient(int id, const string& name, const string& medicalHistory, const string& department,
+            const string& condition, const Date& admissionDate, const Date& dischargeDate, int roomNumber)
+        : id(id), name(name), medicalHistory(medicalHistory), department(department),
+          condition(condition), admissionDate(admissionDate), dischargeDate(dischargeDate),
+          roomNumber(roomNumber) {}
+
     void display() const {
-        cout << "-------------------------------------\n";
-        cout << "ID: " << id << "\n"
-             << "Name: " << name << "\n"
-             << "Medical History: " << medicalHistory << "\n"
-             << "Department: " << department << "\n"
-             << "Condition: " << condition << "\n"
-             << "Admission Date: " << admissionDate.toString() << "\n"
-             << "Discharge Date: " << dischargeDate.toString() << "\n"
-             << "Room Number: " << roomNumber << "\n";
-        cout << "-------------------------------------\n";
+        string block;
+        appendDisplay(block);
+        cout << block;
+    }
+
+    void appendDisplay(string& out) const {
+        appendRecordDisplay(out, *this);
+    }
+
+    void appendCSV(string& out) const {
+        appendRecordCSV(out, *this);
+    }
+
+    void appendJSON(string& out) const {
+        appendRecordJSON(out, *this);
     }
 
     string toCSV() const {
-        stringstream ss;
-        ss << id << "," 
-           << name << "," 
-           << medicalHistory << "," 
-           << department << "," 
-           << condition << "," 
-           << admissionDate.toString() << "," 
-           << dischargeDate.toString() << "," 
-           << roomNumber;
-        return ss.str();
+        string row;
+        appendCSV(row);
+        return row;
     }
 };
 
-class HospitalSystem {
-private:
-    vector<Patient> patients;
-    string csvFilename;
-    int nextPatientId;
-    
-        unordered_map<int, int> idToIndex;  
-    unordered_map<string, vector<int>, CaseInsensitiveHash, CaseInsensitiveEqual> nameToIndices;
-    unordered_map<string, vector<int>, CaseInsensitiveHash, CaseInsensitiveEqual> departmentToIndices;
-    unordered_map<string, vector<int>, CaseInsensitiveHash, CaseInsensitiveEqual> conditionToIndices;
-    unordered_map<int, vector<int>> roomToIndices;
-
+// Stored form of a Patient: the same fields, with the name and medical
+// history held in the owning HospitalSystem's TextArena and the department
+// and condition as codes into its CodeDictionaries. toPatient() copies the
+// text out, which is what the thread-safe API hands to callers. (id and
+// roomNumber sit together so the dictionary pointer fits in what was padding.)
+class PatientRecord {
 public:
-        int getPatientCount() const {
-        return patients.size();
+    int id;
+    int roomNumber;
+    StrRef name;
+    StrRef medicalHistory;
+    uint32_t departmentCode;
+    uint32_t conditionCode;
+    Date admissionDate;
+    Date dischargeDate;
+    const CodeDictionaries* dictionaries;
+
+    PatientRecord() : id(0), roomNumber(0), departmentCode(0), conditionCode(0), dictionaries(nullptr) {}
+
+    PatientRecord(const Patient& patient, TextArena& text, CodeDictionaries& codes)
+        : id(patient.id), roomNumber(patient.roomNumber), name(text.store(patient.name)),
+          medicalHistory(text.store(patient.medicalHistory)),
+          departmentCode(codes.departments.intern(patient.department)),
+          conditionCode(codes.conditions.intern(patient.condition)),
+          admissionDate(patient.admissionDate), dischargeDate(patient.dischargeDate), dictionaries(&codes) {}
+
+    Patient toPatient() const {
+        return Patient(id, name.str(), medicalHistory.str(), department(), condition(),
+                       admissionDate, dischargeDate, roomNumber);
     }
 
-    int getAvailableRooms() const {
-        int available = 0;
-        for (int i = 1; i <= 200; i++) {
-            if (isRoomAvailable(i)) {
-                available++;
-            }
-        }
-        return available;
+    void releaseText(TextArena& text) const {
+        text.release(name);
+        text.release(medicalHistory);
     }
 
-    int getOccupiedRooms() const {
-        return 200 - getAvailableRooms();
+    const string& department() const {
+        return dictionaries->departments.value(departmentCode);
     }
 
-    void buildIndices() {
-        idToIndex.clear();
-        nameToIndices.clear();
-        departmentToIndices.clear();
-        conditionToIndices.clear();
-        roomToIndices.clear();
-        
-        for (size_t i = 0; i < patients.size(); i++) {
-            idToIndex[patients[i].id] = i;
-            nameToIndices[patients[i].name].push_back(i);
-            departmentToIndices[patients[i].department].push_back(i);
-            conditionToIndices[patients[i].condition].push_back(i);
-            roomToIndices[patients[i].roomNumber].push_back(i);
-        }
-        
-        nextPatientId = 1;
-        for (const auto& patient : patients) {
-            nextPatientId = max(nextPatientId, patient.id + 1);
-        }
+    const string& condition() const {
+        return dictionaries->conditions.value(conditionCode);
     }
 
-    HospitalSystem(const string& filename) : csvFilename(filename), nextPatientId(1) {
-        if (!loadFromCSV(csvFilename)) {
-            throw runtime_error("Error: Could not open file " + filename + ". Please check if the file exists and try again.");
+    void display() const {
+        string block;
+        appendRecordDisplay(block, *this);
+        cout << block;
+    }
+
+    void appendCSV(string& out) const {
+        appendRecordCSV(out, *this);
+    }
+};
+
+inline const string& departmentOf(const Patient& patient) {
+    return patient.department;
+}
+
+inline const string& conditionOf(const Patient& patient) {
+    return patient.condition;
+}
+
+inline const string& departmentOf(const PatientRecord& record) {
+    return record.department();
+}
+
+inline const string& conditionOf(const PatientRecord& record) {
+    return record.condition();
+}
+
+enum OutputFormat {
+    OutputRecord,  // the display() block
+    OutputTable,
+    OutputCSV,
+    OutputNDJSON
+};
+
+inline bool parseOutputFormat(const string& text, OutputFormat& format) {
+    static const char* names[] = {"record", "table", "csv", "ndjson"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (CaseInsensitiveEqual()(text, names[i])) {
+            format = static_cast<OutputFormat>(i);
+            return true;
         }
     }
+    return false;
+}
 
-    bool loadFromCSV(const string& filename) {
-        ifstream file(filename);
-        if (!file) {
-            return false;
+// True when both ends of the console are a terminal, i.e. a person is
+// reading the listing rather than a pipe or a script.
+inline bool interactiveConsole() {
+#ifdef _WIN32
+    return _isatty(_fileno(stdin)) && _isatty(_fileno(stdout));
+#else
+    return isatty(fileno(stdin)) && isatty(fileno(stdout));
+#endif
+}
+
+// Streams patient rows to an ostream in one of the OutputFormats. Rows are
+// rendered into a reusable buffer with appendInt/appendDate and handed to
+// the stream in flushBytes-sized write() calls, so a listing of any length
+// costs one buffer of memory and the first rows appear without waiting for
+// the rest. With a pager set, output stops every pageLines lines and
+// continues only while the pager returns true.
+class RecordWriter {
+public:
+    static const size_t flushBytes = 64 * 1024;
+
+private:
+    ostream& out;
+    OutputFormat format;
+    string buffer;
+    function<bool()> pager;
+    size_t pageLines;
+    size_t linesOnPage;
+    size_t rows;
+    bool started;
+    bool stopped;
+
+    static void appendCell(string& out, StrRef text, size_t width) {
+        size_t length = min(text.size, width - 1);
+        out.append(text.data, length);
+        out.append(width - length, ' ');
+    }
+
+    static void appendNumberCell(string& out, long long value, size_t width) {
+        size_t start = out.size();
+        appendInt(out, value);
+        size_t length = out.size() - start;
+        if (length < width - 1) {
+            out.insert(start, width - 1 - length, ' ');
         }
+        out += ' ';
+    }
 
-        patients.clear();
-        string line;
-        while (getline(file, line)) {
-            if (line.substr(0, 2) != "//") {
-                stringstream ss(line);
-                string field;
-                vector<string> fields;
-                
-                while (getline(ss, field, ',')) {
-                    fields.push_back(field);
-                }
-                if (fields.size() == 8) {
-                    try {
-                        int id = stoi(fields[0]);
-                        int room = stoi(fields[7]);
-                        patients.emplace_back(id, fields[1], fields[2], fields[3], 
-                                          fields[4], fields[5], fields[6], room);
-                    } catch (const exception& e) {
-                        cerr << "Error parsing line: " << line << endl;
-                    }
-                }
-            }
+    static void appendDateCell(string& out, const Date& date, size_t width) {
+        size_t start = out.size();
+        if (date.isValid()) {
+            appendDate(out, date);
+        } else {
+            out += '-';
         }
+        out.append(width - (out.size() - start), ' ');
+    }
 
-        buildIndices();
-        
-        cout << "Loaded " << patients.size() << " patient records from " << filename << endl;
-        return true;
+    template <typename Record>
+    void appendTableRow(const Record& patient) {
+        appendNumberCell(buffer, patient.id, 8);
+        appendCell(buffer, patient.name, 24);
+        appendCell(buffer, patient.medicalHistory, 24);
+        appendCell(buffer, departmentOf(patient), 18);
+        appendCell(buffer, conditionOf(patient), 12);
+        appendDateCell(buffer, patient.admissionDate, 12);
+        appendDateCell(buffer, patient.dischargeDate, 12);
+        appendInt(buffer, patient.roomNumber);
+        buffer += '\n';
     }
 
-    void saveToCSV() {
-        ofstream file(csvFilename);
-        if (!file.is_open()) {
-            cout << "Error: Cannot open file for writing: " << csvFilename << endl;
+    void begin() {
+        started = true;
+        if (format == OutputCSV) {
+            buffer += "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+        } else if (format == OutputTable) {
+            buffer += "      ID Name                    Medical History         Department        "
+                      "Condition   Admitted    Discharged  Room\n";
+        } else {
             return;
         }
+        linesOnPage++;
+    }
+
+public:
+    RecordWriter(ostream& out, OutputFormat format)
+        : out(out), format(format), pageLines(0), linesOnPage(0), rows(0), started(false), stopped(false) {
+        buffer.reserve(flushBytes + 4096);
+    }
+
+    ~RecordWriter() {
+        flush();
+    }
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    void setPager(size_t lines, function<bool()> prompt) {
+        pageLines = lines;
+        pager = prompt;
+    }
+
+    // Appends one row; returns false once the pager has asked to stop, after
+    // which further rows are dropped.
+    template <typename Record>
+    bool write(const Record& patient) {
+        if (stopped) {
+            return false;
+        }
+        if (!started) {
+            begin();
+        }
+        size_t lines = format == OutputRecord ? 10 : 1;
+        if (pager && pageLines != 0 && rows != 0 && linesOnPage + lines > pageLines) {
+            flush();
+            if (!pager()) {
+                stopped = true;
+                return false;
+            }
+            linesOnPage = 0;
+        }
+        switch (format) {
+            case OutputRecord: appendRecordDisplay(buffer, patient); break;
+            case OutputTable: appendTableRow(patient); break;
+            case OutputCSV: appendRecordCSV(buffer, patient); buffer += '\n'; break;
+            case OutputNDJSON: appendRecordJSON(buffer, patient); buffer += '\n'; break;
+        }
+        rows++;
+        linesOnPage += lines;
+        if (buffer.size() >= flushBytes) {
+            flush();
+        }
+        return true;
+    }
+
+    // Writes any buffered rows; a CSV or table listing with no rows still
+    // gets its header.
+    void flush() {
+        if (!started && !stopped) {
+            begin();
+        }
+        if (!buffer.empty()) {
+            out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+            buffer.clear();
+        }
+        out.flush();
+    }
+
+    size_t rowsWritten() const {
+        return rows;
+    }
+
+    bool stoppedEarly() const {
+        return stopped;
+    }
+};
+
+inline void syncFile(FILE* file) {
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+// Writes go to "<path>.tmp"; commit() syncs it and renames it over the
+// target, so readers never observe a partially written file.
+class AtomicFile {
+private:
+    FILE* file;
+    string path;
+    string tempPath;
+    bool failed;
+
+public:
+    explicit AtomicFile(const string& target)
+        : file(nullptr), path(target), tempPath(target + ".tmp"), failed(false) {
+        file = fopen(tempPath.c_str(), "wb");
+    }
+
+    ~AtomicFile() {
+        if (file) {
+            fclose(file);
+            remove(tempPath.c_str());
+        }
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    void write(const void* data, size_t size) {
+        if (file && size > 0 && fwrite(data, 1, size, file) != size) {
+            failed = true;
+        }
+    }
+
+    bool commit() {
+        if (!file) {
+            return false;
+        }
+        syncFile(file);
+        bool ok = !failed && !ferror(file);
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+#ifdef _WIN32
+        if (ok) remove(path.c_str());
+#endif
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+            remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// Slot-map storage: records live in stable slots, deletes leave a
+// tombstone whose slot is reused by the next insert, and compact() squeezes
+// the tombstones out once they pile up. Slot numbers are the handles the
+// indices keep; they stay valid until the next compaction, after which the
+// indices are rebuilt.
+template <typename T>
+class SlotStore {
+private:
+    vector<T> items;
+    vector<char> live;
+    vector<int> freeSlots;
+    size_t liveCount;
+
+public:
+    class const_iterator {
+    private:
+        const SlotStore* store;
+        size_t slot;
+
+        void skipDead() {
+            while (slot < store->items.size() && !store->live[slot]) slot++;
+        }
+
+    public:
+        const_iterator(const SlotStore* store, size_t slot) : store(store), slot(slot) {
+            skipDead();
+        }
+
+        const T& operator*() const {
+            return store->items[slot];
+        }
+
+        const T* operator->() const {
+            return &store->items[slot];
+        }
+
+        const_iterator& operator++() {
+            slot++;
+            skipDead();
+            return *this;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return slot != other.slot;
+        }
+    };
+
+    SlotStore() : liveCount(0) {}
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, items.size());
+    }
+
+    // Number of live records.
+    size_t size() const {
+        return liveCount;
+    }
+
+    bool empty() const {
+        return liveCount == 0;
+    }
+
+    // Number of slots including tombstones; valid slots are [0, slotCount()).
+    int slotCount() const {
+        return static_cast<int>(items.size());
+    }
+
+    size_t tombstones() const {
+        return freeSlots.size();
+    }
+
+    bool isLive(int slot) const {
+        return slot >= 0 && slot < slotCount() && live[slot];
+    }
+
+    T& operator[](int slot) {
+        return items[slot];
+    }
+
+    const T& operator[](int slot) const {
+        return items[slot];
+    }
+
+    void reserve(size_t count) {
+        items.reserve(count);
+        live.reserve(count);
+    }
+
+    void clear() {
+        items.clear();
+        live.clear();
+        freeSlots.clear();
+        liveCount = 0;
+    }
+
+    // Appends without consulting the free list (bulk load).
+    int push_back(const T& value) {
+        items.push_back(value);
+        live.push_back(1);
+        liveCount++;
+        return slotCount() - 1;
+    }
+
+    int insert(const T& value) {
+        if (freeSlots.empty()) {
+            return push_back(value);
+        }
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        items[slot] = value;
+        live[slot] = 1;
+        liveCount++;
+        return slot;
+    }
+
+    void erase(int slot) {
+        if (!isLive(slot)) {
+            return;
+        }
+        live[slot] = 0;
+        freeSlots.push_back(slot);
+        liveCount--;
+    }
+
+    // Moves live records down over the tombstones, preserving order.
+    void compact() {
+        size_t next = 0;
+        for (size_t slot = 0; slot < items.size(); slot++) {
+            if (!live[slot]) continue;
+            if (next != slot) {
+                items[next] = items[slot];
+            }
+            live[next++] = 1;
+        }
+        items.erase(items.begin() + next, items.end());
+        live.resize(next);
+        freeSlots.clear();
+    }
+};
+
+// Fixed set of worker threads that run indexed tasks. run() hands out task
+// numbers from a shared counter, so uneven chunks balance themselves, and the
+// calling thread works alongside the pool until every task has finished.
+class WorkerPool {
+private:
+    vector<thread> threads;
+    mutex stateLock;
+    mutex runLock;
+    condition_variable wake;
+    condition_variable finished;
+    const function<void(size_t)>* job;
+    size_t taskCount;
+    atomic<size_t> nextTask;
+    size_t generation;
+    size_t busy;
+    bool stopping;
+
+    void work() {
+        size_t task;
+        while ((task = nextTask.fetch_add(1)) < taskCount) {
+            (*job)(task);
+        }
+    }
+
+    void loop() {
+        size_t seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(stateLock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work();
+            lock_guard<mutex> guard(stateLock);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t workers)
+        : job(nullptr), taskCount(0), nextTask(0), generation(0), busy(0), stopping(false) {
+        for (size_t i = 1; i < workers; i++) {
+            threads.push_back(thread(&WorkerPool::loop, this));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) worker.join();
+    }
+
+    // Number of threads that execute tasks, including the caller.
+    size_t size() const {
+        return threads.size() + 1;
+    }
+
+    void run(size_t count, const function<void(size_t)>& task) {
+        lock_guard<mutex> serial(runLock);
+        {
+            lock_guard<mutex> guard(stateLock);
+            job = &task;
+            taskCount = count;
+            nextTask = 0;
+            busy = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        unique_lock<mutex> guard(stateLock);
+        finished.wait(guard, [&] { return busy == 0; });
+        job = nullptr;
+    }
+};
+
+// Reader-writer lock for C++11, which has no std::shared_mutex. Waiting
+// writers hold off new readers, so a steady stream of queries cannot starve
+// admissions. lock()/unlock() make it usable with lock_guard.
+class SharedMutex {
+private:
+    mutex state;
+    condition_variable gate;
+    size_t readers;
+    size_t waitingWriters;
+    bool writing;
+
+public:
+    SharedMutex() : readers(0), waitingWriters(0), writing(false) {}
+
+    void lock() {
+        unique_lock<mutex> guard(state);
+        waitingWriters++;
+        gate.wait(guard, [&] { return !writing && readers == 0; });
+        waitingWriters--;
+        writing = true;
+    }
+
+    void unlock() {
+        {
+            lock_guard<mutex> guard(state);
+            writing = false;
+        }
+        gate.notify_all();
+    }
+
+    void lock_shared() {
+        unique_lock<mutex> guard(state);
+        gate.wait(guard, [&] { return !writing && waitingWriters == 0; });
+        readers++;
+    }
+
+    void unlock_shared() {
+        bool last;
+        {
+            lock_guard<mutex> guard(state);
+            last = --readers == 0;
+        }
+        if (last) gate.notify_all();
+    }
+};
+
+class ReadLock {
+private:
+    SharedMutex& target;
+
+public:
+    explicit ReadLock(SharedMutex& target) : target(target) {
+        target.lock_shared();
+    }
+
+    ~ReadLock() {
+        target.unlock_shared();
+    }
+
+    ReadLock(const ReadLock&) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+};
+
+// HDR-style log-linear histogram: values below 16 are exact, larger ones
+// fall into 16 sub-buckets per power of two, so any recorded value is
+// reported within about 6% using a fixed 8 KB of counters. Counters are
+// relaxed atomics, so concurrent threads can record into one histogram.
+class HdrHistogram {
+public:
+    static const int subBuckets = 16;
+    static const int bucketCount = subBuckets + (64 - 4) * subBuckets;
+
+private:
+    atomic<uint64_t> counts[bucketCount];
+    atomic<uint64_t> total;
+    atomic<uint64_t> sum;
+    atomic<uint64_t> maximum;
+
+public:
+    static int bucketOf(uint64_t value) {
+        if (value < subBuckets) {
+            return static_cast<int>(value);
+        }
+        int exponent = 63;
+        while (!(value >> exponent)) exponent--;
+        int sub = static_cast<int>((value >> (exponent - 4)) & (subBuckets - 1));
+        return subBuckets + (exponent - 4) * subBuckets + sub;
+    }
+
+    // Middle of the value range a bucket covers.
+    static uint64_t valueOf(int bucket) {
+        if (bucket < subBuckets) {
+            return bucket;
+        }
+        int exponent = (bucket - subBuckets) / subBuckets + 4;
+        uint64_t low = static_cast<uint64_t>(subBuckets + (bucket - subBuckets) % subBuckets) << (exponent - 4);
+        return low + ((1ULL << (exponent - 4)) >> 1);
+    }
+
+    HdrHistogram() {
+        reset();
+    }
+
+    HdrHistogram(const HdrHistogram&) = delete;
+    HdrHistogram& operator=(const HdrHistogram&) = delete;
+
+    void reset() {
+        for (auto& count : counts) count.store(0, memory_order_relaxed);
+        total.store(0, memory_order_relaxed);
+        sum.store(0, memory_order_relaxed);
+        maximum.store(0, memory_order_relaxed);
+    }
+
+    void record(uint64_t value, uint64_t times = 1) {
+        counts[bucketOf(value)].fetch_add(times, memory_order_relaxed);
+        total.fetch_add(times, memory_order_relaxed);
+        sum.fetch_add(value * times, memory_order_relaxed);
+        uint64_t seen = maximum.load(memory_order_relaxed);
+        while (value > seen && !maximum.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+        }
+    }
+
+    void merge(const HdrHistogram& other) {
+        for (int bucket = 0; bucket < bucketCount; bucket++) {
+            uint64_t count = other.counts[bucket].load(memory_order_relaxed);
+            if (count) counts[bucket].fetch_add(count, memory_order_relaxed);
+        }
+        total.fetch_add(other.count(), memory_order_relaxed);
+        sum.fetch_add(other.sum.load(memory_order_relaxed), memory_order_relaxed);
+        uint64_t otherMax = other.max();
+        uint64_t seen = maximum.load(memory_order_relaxed);
+        while (otherMax > seen && !maximum.compare_exchange_weak(seen, otherMax, memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        return total.load(memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return maximum.load(memory_order_relaxed);
+    }
+
+    double mean() const {
+        uint64_t recorded = count();
+        return recorded ? static_cast<double>(sum.load(memory_order_relaxed)) / recorded : 0;
+    }
+
+    // Value at quantile q in [0, 1]; 0 when nothing was recorded.
+    uint64_t percentile(double q) const {
+        uint64_t recorded = count();
+        if (recorded == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(ceil(q * recorded));
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < bucketCount; bucket++) {
+            seen += counts[bucket].load(memory_order_relaxed);
+            if (seen >= rank) {
+                return min(valueOf(bucket), max());
+            }
+        }
+        return max();
+    }
+};
+
+// Single-threaded counterpart of HdrHistogram with the same buckets. The
+// counters are plain and only grow up to the largest bucket recorded, so a
+// histogram of short values costs a few hundred bytes and copies cheaply.
+class CountHistogram {
+private:
+    vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t maximum;
+
+public:
+    CountHistogram() : total(0), sum(0), maximum(0) {}
+
+    void reset() {
+        counts.clear();
+        total = 0;
+        sum = 0;
+        maximum = 0;
+    }
+
+    void record(uint64_t value, uint64_t times = 1) {
+        size_t bucket = static_cast<size_t>(HdrHistogram::bucketOf(value));
+        if (bucket >= counts.size()) counts.resize(bucket + 1, 0);
+        counts[bucket] += times;
+        total += times;
+        sum += value * times;
+        maximum = std::max(maximum, value);
+    }
+
+    void merge(const CountHistogram& other) {
+        if (other.counts.size() > counts.size()) counts.resize(other.counts.size(), 0);
+        for (size_t bucket = 0; bucket < other.counts.size(); bucket++) {
+            counts[bucket] += other.counts[bucket];
+        }
+        total += other.total;
+        sum += other.sum;
+        maximum = std::max(maximum, other.maximum);
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return maximum;
+    }
+
+    double mean() const {
+        return total ? static_cast<double>(sum) / total : 0;
+    }
+
+    // Value at quantile q in [0, 1]; 0 when nothing was recorded.
+    uint64_t percentile(double q) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(ceil(q * total));
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+            seen += counts[bucket];
+            if (seen >= rank) {
+                return std::min(HdrHistogram::valueOf(static_cast<int>(bucket)), maximum);
+            }
+        }
+        return maximum;
+    }
+};
+
+// Operations with a latency histogram in perfRegistry().
+enum PerfOp {
+    PerfLoad, PerfSave, PerfBuildIndices, PerfLookupId, PerfLookupName, PerfLookupDate, PerfQuery,
+    PerfStatistics, PerfAdd, PerfUpdate, PerfDelete, PerfIngest, PerfJournal, PerfOpCount
+};
+
+inline const char* perfOpName(int op) {
+    static const char* names[PerfOpCount] = {"load", "save", "buildIndices", "lookupId", "lookupName",
+                                             "lookupDate", "query", "statistics", "add", "update",
+                                             "delete", "ingest", "journal"};
+    return names[op];
+}
+
+// Process-wide latency histograms in nanoseconds, one per PerfOp.
+class PerfRegistry {
+private:
+    HdrHistogram histograms[PerfOpCount];
+
+public:
+    HdrHistogram& operator[](int op) {
+        return histograms[op];
+    }
+
+    const HdrHistogram& operator[](int op) const {
+        return histograms[op];
+    }
+
+    void reset() {
+        for (HdrHistogram& histogram : histograms) histogram.reset();
+    }
+
+    // One "op,count,mean_us,p50_us,p90_us,p99_us,max_us" line per operation
+    // that has been recorded.
+    void appendCSV(string& out) const {
+        char line[160];
+        for (int op = 0; op < PerfOpCount; op++) {
+            const HdrHistogram& histogram = histograms[op];
+            if (histogram.count() == 0) continue;
+            snprintf(line, sizeof(line), "%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f\n", perfOpName(op),
+                     static_cast<unsigned long long>(histogram.count()), histogram.mean() / 1000,
+                     histogram.percentile(0.5) / 1000.0, histogram.percentile(0.9) / 1000.0,
+                     histogram.percentile(0.99) / 1000.0, histogram.max() / 1000.0);
+            out += line;
+        }
+    }
+};
+
+inline PerfRegistry& perfRegistry() {
+    static PerfRegistry registry;
+    return registry;
+}
+
+// Records the lifetime of the enclosing scope into a histogram.
+class ScopedTimer {
+private:
+    HdrHistogram& histogram;
+    chrono::steady_clock::time_point started;
+
+public:
+    explicit ScopedTimer(HdrHistogram& histogram)
+        : histogram(histogram), started(chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        auto elapsed = chrono::steady_clock::now() - started;
+        histogram.record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Times the rest of the enclosing scope as PerfOp op. Compiling with
+// -DHMS_DISABLE_PERF removes the timers entirely.
+#ifdef HMS_DISABLE_PERF
+#define HMS_PERF_SCOPE(op) ((void)0)
+#else
+#define HMS_PERF_CONCAT2(a, b) a##b
+#define HMS_PERF_CONCAT(a, b) HMS_PERF_CONCAT2(a, b)
+#define HMS_PERF_SCOPE(op) ScopedTimer HMS_PERF_CONCAT(perfTimer, __LINE__)(perfRegistry()[op])
+#endif
+
+// Process-wide pool sized to the hardware, shared by the reporting code.
+inline WorkerPool& sharedWorkerPool() {
+    static WorkerPool pool(max(1u, thread::hardware_concurrency()));
+    return pool;
+}
+
+// Totals for one "who is currently admitted" pass: a record counts as
+// admitted on day D if admission <= D < discharge (an unset discharge date
+// never ends the stay), the same half-open rule the census timeline and the
+// room index use. Every other record, including one admitted after D or
+// discharged on D, counts as discharged.
+struct CensusCounts {
+    size_t admitted;
+    size_t discharged;
+    vector<int> roomOccupants;           // indexed by room number, 0..roomLimit
+    vector<size_t> departmentAdmitted;   // indexed by department code
+    vector<size_t> conditionAdmitted;    // indexed by condition code
+
+    CensusCounts() : admitted(0), discharged(0) {}
+
+    void merge(const CensusCounts& other) {
+        admitted += other.admitted;
+        discharged += other.discharged;
+        for (size_t i = 0; i < roomOccupants.size() && i < other.roomOccupants.size(); i++) {
+            roomOccupants[i] += other.roomOccupants[i];
+        }
+        for (size_t i = 0; i < departmentAdmitted.size() && i < other.departmentAdmitted.size(); i++) {
+            departmentAdmitted[i] += other.departmentAdmitted[i];
+        }
+        for (size_t i = 0; i < conditionAdmitted.size() && i < other.conditionAdmitted.size(); i++) {
+            conditionAdmitted[i] += other.conditionAdmitted[i];
+        }
+    }
+};
+
+// Column pointers and parameters for one census pass. Packed dates are
+// YYYYMMDD, so they fit comfortably in a signed 32-bit lane.
+struct CensusInput {
+    const uint8_t* live;
+    const int32_t* rooms;
+    const uint32_t* admissions;
+    const uint32_t* discharges;
+    const uint32_t* departments;
+    const uint32_t* conditions;
+    uint32_t day;
+    int roomLimit;
+};
+
+// Tallies slots [begin, end) into counts, whose histograms must already be
+// sized, and returns the number of live slots seen.
+typedef size_t (*CensusKernel)(const CensusInput& input, size_t begin, size_t end, CensusCounts& counts);
+
+inline void tallyAdmitted(const CensusInput& input, size_t slot, CensusCounts& counts) {
+    counts.admitted++;
+    int room = input.rooms[slot];
+    if (room >= 1 && room <= input.roomLimit) counts.roomOccupants[room]++;
+    if (input.departments[slot] < counts.departmentAdmitted.size()) counts.departmentAdmitted[input.departments[slot]]++;
+    if (input.conditions[slot] < counts.conditionAdmitted.size()) counts.conditionAdmitted[input.conditions[slot]]++;
+}
+
+inline size_t censusKernelScalar(const CensusInput& input, size_t begin, size_t end, CensusCounts& counts) {
+    size_t total = 0;
+    for (size_t slot = begin; slot < end; slot++) {
+        if (!input.live[slot]) continue;
+        total++;
+        uint32_t admission = input.admissions[slot];
+        uint32_t discharge = input.discharges[slot];
+        if (admission == 0 || admission > input.day || (discharge != 0 && discharge <= input.day)) continue;
+        tallyAdmitted(input, slot, counts);
+    }
+    return total;
+}
+
+#if HMS_HAVE_AVX2
+// Builds the active mask eight slots at a time and only visits the slots
+// whose bit is set, so mostly-discharged archives cost one compare chain
+// per eight rows.
+__attribute__((target("avx2,popcnt")))
+inline size_t censusKernelAvx2(const CensusInput& input, size_t begin, size_t end, CensusCounts& counts) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i day = _mm256_set1_epi32(static_cast<int>(input.day));
+    size_t total = 0;
+    size_t slot = begin;
+    for (; slot + 8 <= end; slot += 8) {
+        __m256i live = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(input.live + slot)));
+        __m256i admission = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.admissions + slot));
+        __m256i discharge = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.discharges + slot));
+
+        __m256i liveMask = _mm256_cmpgt_epi32(live, zero);
+        __m256i admitted = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(admission, zero),
+                                                               _mm256_cmpgt_epi32(admission, day)), liveMask);
+        __m256i stillIn = _mm256_or_si256(_mm256_cmpeq_epi32(discharge, zero), _mm256_cmpgt_epi32(discharge, day));
+        __m256i active = _mm256_and_si256(stillIn, admitted);
+
+        total += _mm_popcnt_u32(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(liveMask))));
+        unsigned bits = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(active)));
+        while (bits) {
+            tallyAdmitted(input, slot + __builtin_ctz(bits), counts);
+            bits &= bits - 1;
+        }
+    }
+    return total + censusKernelScalar(input, slot, end, counts);
+}
+#endif
+
+// Picks the widest census kernel the running CPU supports. Builds for
+// compilers without GCC-style target attributes always use the scalar one.
+inline CensusKernel selectCensusKernel() {
+#if HMS_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return censusKernelAvx2;
+    }
+#endif
+    return censusKernelScalar;
+}
+
+inline CensusKernel activeCensusKernel() {
+    static const CensusKernel kernel = selectCensusKernel();
+    return kernel;
+}
+
+inline const char* censusKernelName(CensusKernel kernel) {
+    return kernel == censusKernelScalar ? "scalar" : "avx2";
+}
+
+// Structure-of-arrays mirror of the fields the analytics scans read,
+// indexed by slot. The text fields stay in the slot store, which serves as
+// their side pool; scans over dates, rooms and codes only touch these
+// contiguous columns.
+class PatientColumns {
+public:
+    vector<int32_t> ids;
+    vector<int32_t> rooms;
+    vector<uint32_t> admissions;
+    vector<uint32_t> discharges;
+    vector<uint32_t> departments;
+    vector<uint32_t> conditions;
+    vector<uint8_t> live;
+    uint32_t departmentCodes;             // one past the largest code stored,
+    uint32_t conditionCodes;              // which sizes the per-code counts
+
+    PatientColumns() : departmentCodes(0), conditionCodes(0) {}
+
+    void clear() {
+        ids.clear();
+        rooms.clear();
+        admissions.clear();
+        discharges.clear();
+        departments.clear();
+        conditions.clear();
+        live.clear();
+        departmentCodes = 0;
+        conditionCodes = 0;
+    }
+
+    size_t slotCount() const {
+        return live.size();
+    }
+
+    void set(int slot, const PatientRecord& patient) {
+        if (slot >= static_cast<int>(live.size())) {
+            size_t count = slot + 1;
+            ids.resize(count);
+            rooms.resize(count);
+            admissions.resize(count);
+            discharges.resize(count);
+            departments.resize(count);
+            conditions.resize(count);
+            live.resize(count);
+        }
+        ids[slot] = patient.id;
+        rooms[slot] = patient.roomNumber;
+        admissions[slot] = patient.admissionDate.packed();
+        discharges[slot] = patient.dischargeDate.packed();
+        departments[slot] = patient.departmentCode;
+        conditions[slot] = patient.conditionCode;
+        live[slot] = 1;
+        departmentCodes = max(departmentCodes, patient.departmentCode + 1);
+        conditionCodes = max(conditionCodes, patient.conditionCode + 1);
+    }
+
+    void erase(int slot) {
+        if (slot >= 0 && slot < static_cast<int>(live.size())) {
+            live[slot] = 0;
+        }
+    }
+
+    CensusInput censusInput(const Date& day, int roomLimit) const {
+        CensusInput input;
+        input.live = live.data();
+        input.rooms = rooms.data();
+        input.admissions = admissions.data();
+        input.discharges = discharges.data();
+        input.departments = departments.data();
+        input.conditions = conditions.data();
+        input.day = day.packed();
+        input.roomLimit = roomLimit;
+        return input;
+    }
+
+    CensusCounts census(const Date& day, int roomLimit, CensusKernel kernel = activeCensusKernel()) const {
+        CensusCounts counts;
+        counts.roomOccupants.assign(roomLimit + 1, 0);
+        counts.departmentAdmitted.assign(departmentCodes, 0);
+        counts.conditionAdmitted.assign(conditionCodes, 0);
+        size_t total = kernel(censusInput(day, roomLimit), 0, live.size(), counts);
+        counts.discharged = total - counts.admitted;
+        return counts;
+    }
+
+    bool operator==(const PatientColumns& other) const {
+        size_t count = max(live.size(), other.live.size());
+        for (size_t slot = 0; slot < count; slot++) {
+            bool leftLive = slot < live.size() && live[slot];
+            bool rightLive = slot < other.live.size() && other.live[slot];
+            if (leftLive != rightLive) return false;
+            if (!leftLive) continue;
+            if (ids[slot] != other.ids[slot] || rooms[slot] != other.rooms[slot] ||
+                admissions[slot] != other.admissions[slot] || discharges[slot] != other.discharges[slot] ||
+                departments[slot] != other.departments[slot] || conditions[slot] != other.conditions[slot]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(const PatientColumns& other) const {
+        return !(*this == other);
+    }
+};
+
+// Everything showStatistics prints that comes from a scan over the records.
+// Partial reports built over disjoint slot ranges merge by addition.
+struct StatisticsReport {
+    static const int maxStayDays = 365;   // longer stays share the last bucket
+
+    size_t total;
+    vector<size_t> departmentTotals;      // indexed by department code
+    vector<size_t> conditionTotals;       // indexed by condition code
+    vector<size_t> roomAssignments;       // records per room, 0..roomLimit
+    vector<size_t> stayDays;              // completed stays by length in days
+    CensusCounts census;
+
+    StatisticsReport() : total(0) {}
+
+    void reset(int roomLimit, size_t departments, size_t conditions) {
+        total = 0;
+        departmentTotals.assign(departments, 0);
+        conditionTotals.assign(conditions, 0);
+        roomAssignments.assign(roomLimit + 1, 0);
+        stayDays.assign(maxStayDays + 2, 0);
+        census = CensusCounts();
+        census.roomOccupants.assign(roomLimit + 1, 0);
+        census.departmentAdmitted.assign(departmentTotals.size(), 0);
+        census.conditionAdmitted.assign(conditionTotals.size(), 0);
+    }
+
+    void merge(const StatisticsReport& other) {
+        total += other.total;
+        for (size_t i = 0; i < departmentTotals.size() && i < other.departmentTotals.size(); i++) {
+            departmentTotals[i] += other.departmentTotals[i];
+        }
+        for (size_t i = 0; i < conditionTotals.size() && i < other.conditionTotals.size(); i++) {
+            conditionTotals[i] += other.conditionTotals[i];
+        }
+        for (size_t i = 0; i < roomAssignments.size() && i < other.roomAssignments.size(); i++) {
+            roomAssignments[i] += other.roomAssignments[i];
+        }
+        for (size_t i = 0; i < stayDays.size() && i < other.stayDays.size(); i++) {
+            stayDays[i] += other.stayDays[i];
+        }
+        census.merge(other.census);
+    }
+};
+
+// Fills report with the statistics for slots [begin, end).
+inline void accumulateStatistics(const PatientColumns& columns, const Date& day, int roomLimit,
+                                 size_t begin, size_t end, StatisticsReport& report) {
+    report.reset(roomLimit, columns.departmentCodes, columns.conditionCodes);
+    size_t live = activeCensusKernel()(columns.censusInput(day, roomLimit), begin, end, report.census);
+    report.total = live;
+    report.census.discharged = live - report.census.admitted;
+    for (size_t slot = begin; slot < end; slot++) {
+        if (!columns.live[slot]) continue;
+        if (columns.departments[slot] < report.departmentTotals.size()) report.departmentTotals[columns.departments[slot]]++;
+        if (columns.conditions[slot] < report.conditionTotals.size()) report.conditionTotals[columns.conditions[slot]]++;
+        int room = columns.rooms[slot];
+        if (room >= 1 && room <= roomLimit) report.roomAssignments[room]++;
+        uint32_t admission = columns.admissions[slot];
+        uint32_t discharge = columns.discharges[slot];
+        if (admission != 0 && discharge >= admission) {
+            int days = Date::fromPacked(admission).daysUntil(Date::fromPacked(discharge));
+            report.stayDays[min(days, StatisticsReport::maxStayDays + 1)]++;
+        }
+    }
+}
+
+// Splits the slots into chunks, aggregates each chunk on the pool into its
+// own partial report and merges the partials.
+inline StatisticsReport computeStatistics(const PatientColumns& columns, const Date& day, int roomLimit,
+                                          WorkerPool& pool) {
+    HMS_PERF_SCOPE(PerfStatistics);
+    const size_t minChunk = 1 << 16;
+    size_t slots = columns.slotCount();
+    size_t chunks = max<size_t>(1, min(pool.size() * 4, (slots + minChunk - 1) / minChunk));
+    size_t chunkSize = (slots + chunks - 1) / chunks;
+    vector<StatisticsReport> partials(chunks);
+    pool.run(chunks, [&](size_t chunk) {
+        size_t begin = min(slots, chunk * chunkSize);
+        accumulateStatistics(columns, day, roomLimit, begin, min(slots, begin + chunkSize), partials[chunk]);
+    });
+    StatisticsReport report = partials[0];
+    for (size_t chunk = 1; chunk < chunks; chunk++) {
+        report.merge(partials[chunk]);
+    }
+    return report;
+}
+
+// Array-of-structs version of PatientColumns::census, kept for comparison
+// in the columnar benchmark.
+inline CensusCounts censusOfRecords(const SlotStore<PatientRecord>& records, const CodeDictionaries& codes,
+                                    const Date& day, int roomLimit) {
+    CensusCounts counts;
+    counts.roomOccupants.assign(roomLimit + 1, 0);
+    counts.departmentAdmitted.assign(codes.departments.size(), 0);
+    counts.conditionAdmitted.assign(codes.conditions.size(), 0);
+    for (const PatientRecord& patient : records) {
+        if (!patient.admissionDate.isValid() || day < patient.admissionDate ||
+            (patient.dischargeDate.isValid() && !(day < patient.dischargeDate))) continue;
+        counts.admitted++;
+        if (patient.roomNumber >= 1 && patient.roomNumber <= roomLimit) counts.roomOccupants[patient.roomNumber]++;
+        if (patient.departmentCode < counts.departmentAdmitted.size()) counts.departmentAdmitted[patient.departmentCode]++;
+        if (patient.conditionCode < counts.conditionAdmitted.size()) counts.conditionAdmitted[patient.conditionCode]++;
+    }
+    counts.discharged = records.size() - counts.admitted;
+    return counts;
+}
+
+// Array-of-structs version of accumulateStatistics over every record, kept
+// for comparison in the columnar benchmark.
+inline StatisticsReport statisticsOfRecords(const SlotStore<PatientRecord>& records, const CodeDictionaries& codes,
+                                            const Date& day, int roomLimit) {
+    StatisticsReport report;
+    report.reset(roomLimit, codes.departments.size(), codes.conditions.size());
+    report.census = censusOfRecords(records, codes, day, roomLimit);
+    report.total = records.size();
+    for (const PatientRecord& patient : records) {
+        if (patient.departmentCode < report.departmentTotals.size()) report.departmentTotals[patient.departmentCode]++;
+        if (patient.conditionCode < report.conditionTotals.size()) report.conditionTotals[patient.conditionCode]++;
+        if (patient.roomNumber >= 1 && patient.roomNumber <= roomLimit) report.roomAssignments[patient.roomNumber]++;
+        if (patient.admissionDate.isValid() && patient.dischargeDate.isValid() &&
+            !(patient.dischargeDate < patient.admissionDate)) {
+            int days = patient.admissionDate.daysUntil(patient.dischargeDate);
+            report.stayDays[min(days, StatisticsReport::maxStayDays + 1)]++;
+        }
+    }
+    return report;
+}
+
+// StatisticsReport for one day, kept current record by record instead of
+// recomputed. Each record adds a fixed set of +1s, so inserting or erasing
+// one is O(1); the only entries that depend on the day are the admitted /
+// discharged split, and moving the day re-tallies just the records admitted
+// or discharged between the old and the new day.
+class DashboardCounters {
+private:
+    StatisticsReport report;
+    Date day;
+    int roomLimit;
+
+    static void bump(size_t& counter, int sign) {
+        counter = sign > 0 ? counter + 1 : counter - 1;
+    }
+
+    static void bump(vector<size_t>& counters, uint32_t code, int sign) {
+        if (code >= counters.size()) {
+            counters.resize(code + 1, 0);
+        }
+        bump(counters[code], sign);
+    }
+
+    static bool sameCounts(const vector<size_t>& left, const vector<size_t>& right) {
+        for (size_t code = 0; code < max(left.size(), right.size()); code++) {
+            size_t a = code < left.size() ? left[code] : 0;
+            size_t b = code < right.size() ? right[code] : 0;
+            if (a != b) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename Record>
+    void apply(const Record& record, int sign) {
+        bump(report.total, sign);
+        bump(report.departmentTotals, record.departmentCode, sign);
+        bump(report.conditionTotals, record.conditionCode, sign);
+        bool inRange = record.roomNumber >= 1 && record.roomNumber <= roomLimit;
+        if (inRange) bump(report.roomAssignments[record.roomNumber], sign);
+        if (record.admissionDate.isValid() && record.dischargeDate.isValid() &&
+            !(record.dischargeDate < record.admissionDate)) {
+            int days = record.admissionDate.daysUntil(record.dischargeDate);
+            bump(report.stayDays[min(days, StatisticsReport::maxStayDays + 1)], sign);
+        }
+        // same rule as the census kernels: admission <= day < discharge
+        if (!record.admissionDate.isValid() || day < record.admissionDate ||
+            (record.dischargeDate.isValid() && !(day < record.dischargeDate))) {
+            bump(report.census.discharged, sign);
+            return;
+        }
+        bump(report.census.admitted, sign);
+        if (inRange) report.census.roomOccupants[record.roomNumber] += sign;
+        bump(report.census.departmentAdmitted, record.departmentCode, sign);
+        bump(report.census.conditionAdmitted, record.conditionCode, sign);
+    }
+
+public:
+    DashboardCounters() : roomLimit(0) {}
+
+    // Takes over a report computed in one pass for the given day.
+    void reset(const StatisticsReport& computed, const Date& reportDay, int rooms) {
+        report = computed;
+        day = reportDay;
+        roomLimit = rooms;
+    }
+
+    template <typename Record>
+    void insert(const Record& record) {
+        apply(record, 1);
+    }
+
+    template <typename Record>
+    void erase(const Record& record) {
+        apply(record, -1);
+    }
+
+    // Moves the counters to another day. Only records admitted or
+    // discharged between the two days change sides; the caller erases those
+    // before and inserts them again after.
+    void setDay(const Date& newDay) {
+        day = newDay;
+    }
+
+    Date getDay() const {
+        return day;
+    }
+
+    const StatisticsReport& view() const {
+        return report;
+    }
+
+    // Equal up to trailing zero codes, which a fresh report sized to the
+    // dictionary may have and the counters may not (or the other way round).
+    bool matches(const StatisticsReport& other) const {
+        return report.total == other.total &&
+               sameCounts(report.departmentTotals, other.departmentTotals) &&
+               sameCounts(report.conditionTotals, other.conditionTotals) &&
+               report.roomAssignments == other.roomAssignments && report.stayDays == other.stayDays &&
+               report.census.admitted == other.census.admitted &&
+               report.census.discharged == other.census.discharged &&
+               report.census.roomOccupants == other.census.roomOccupants &&
+               sameCounts(report.census.departmentAdmitted, other.census.departmentAdmitted) &&
+               sameCounts(report.census.conditionAdmitted, other.census.conditionAdmitted);
+    }
+
+};
+
+// Admission history as a timeline of per-day deltas: +1 on the day a stay
+// starts and -1 on the day it ends. The deltas are held in Fenwick trees,
+// one for the whole hospital and one per department, so the census on any
+// day is a prefix sum in O(log days) and adding or removing a stay touches
+// two entries per tree. A stay counts on the days admission <= day <
+// discharge, as in RoomOccupancyIndex and the "active" query; stays without
+// an admission date, or that end before they start, are not on the timeline.
+// The trees cover the days seen so far and double when a stay falls outside.
+class CensusTimeline {
+private:
+    int firstDay;  // day number of position 0
+    vector<int32_t> total;
+    vector<vector<int32_t>> departments;  // indexed by department code; empty until used
+
+    static void addAt(vector<int32_t>& tree, size_t pos, int delta) {
+        for (size_t i = pos + 1; i <= tree.size(); i += i & (0 - i)) {
+            tree[i - 1] += delta;
+        }
+    }
+
+    // Sum of the deltas at positions [0, pos].
+    static long long prefix(const vector<int32_t>& tree, size_t pos) {
+        long long sum = 0;
+        for (size_t i = min(pos + 1, tree.size()); i > 0; i -= i & (0 - i)) {
+            sum += tree[i - 1];
+        }
+        return sum;
+    }
+
+    // In-place conversions between point deltas and a Fenwick tree, O(n).
+    static void toTree(vector<int32_t>& values) {
+        for (size_t i = 1; i <= values.size(); i++) {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= values.size()) values[parent - 1] += values[i - 1];
+        }
+    }
+
+    static void toValues(vector<int32_t>& tree) {
+        for (size_t i = tree.size(); i > 0; i--) {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= tree.size()) tree[parent - 1] -= tree[i - 1];
+        }
+    }
+
+    size_t span() const {
+        return total.size();
+    }
+
+    // Re-lays every tree so that [from, to] is covered.
+    void cover(int from, int to) {
+        if (span() != 0 && from >= firstDay && to < firstDay + static_cast<int>(span())) {
+            return;
+        }
+        int low = span() == 0 ? from : min(from, firstDay);
+        int high = span() == 0 ? to : max(to, firstDay + static_cast<int>(span()) - 1);
+        size_t needed = static_cast<size_t>(high - low + 1);
+        size_t size = 64;
+        while (size < needed * 2) {
+            size *= 2;
+        }
+        // half the range is slack around the days in use, so admissions on
+        // new days do not re-lay the trees every time
+        int start = low - static_cast<int>((size - needed) / 2);
+        relay(total, start, size);
+        for (auto& tree : departments) {
+            if (!tree.empty()) relay(tree, start, size);
+        }
+        firstDay = start;
+    }
+
+    void relay(vector<int32_t>& tree, int start, size_t size) const {
+        vector<int32_t> values(size, 0);
+        toValues(tree);
+        for (size_t i = 0; i < tree.size(); i++) {
+            if (tree[i] != 0) values[firstDay + static_cast<int>(i) - start] = tree[i];
+        }
+        toTree(values);
+        tree.swap(values);
+    }
+
+    vector<int32_t>& departmentTree(uint32_t code) {
+        if (code >= departments.size()) {
+            departments.resize(code + 1);
+        }
+        if (departments[code].empty()) {
+            departments[code].assign(span(), 0);
+        }
+        return departments[code];
+    }
+
+    void apply(const Date& admission, const Date& discharge, uint32_t department, int sign) {
+        if (!admission.isValid() || (discharge.isValid() && !(admission < discharge))) {
+            return;
+        }
+        int start = admission.dayNumber();
+        int end = discharge.isValid() ? discharge.dayNumber() : start;
+        cover(start, end);
+        vector<int32_t>& byDepartment = departmentTree(department);
+        addAt(total, start - firstDay, sign);
+        addAt(byDepartment, start - firstDay, sign);
+        if (discharge.isValid()) {
+            addAt(total, end - firstDay, -sign);
+            addAt(byDepartment, end - firstDay, -sign);
+        }
+    }
+
+    long long activeOn(const vector<int32_t>& tree, const Date& day) const {
+        if (tree.empty() || !day.isValid() || day.dayNumber() < firstDay) {
+            return 0;
+        }
+        return prefix(tree, static_cast<size_t>(day.dayNumber() - firstDay));
+    }
+
+    // Nonzero deltas as (day number, delta), for comparing two timelines
+    // laid out over different ranges.
+    vector<pair<int, int32_t>> deltas(const vector<int32_t>& tree) const {
+        vector<int32_t> values = tree;
+        toValues(values);
+        vector<pair<int, int32_t>> result;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (values[i] != 0) result.push_back(make_pair(firstDay + static_cast<int>(i), values[i]));
+        }
+        return result;
+    }
+
+public:
+    CensusTimeline() : firstDay(0) {}
+
+    void clear() {
+        firstDay = 0;
+        total.clear();
+        departments.clear();
+    }
+
+    void insert(const Date& admission, const Date& discharge, uint32_t department) {
+        apply(admission, discharge, department, 1);
+    }
+
+    void erase(const Date& admission, const Date& discharge, uint32_t department) {
+        apply(admission, discharge, department, -1);
+    }
+
+    // One pass over the columns: deltas are summed into plain arrays and
+    // each turned into a tree in linear time.
+    void build(const PatientColumns& columns) {
+        clear();
+        int low = INT_MAX, high = INT_MIN;
+        for (size_t slot = 0; slot < columns.slotCount(); slot++) {
+            uint32_t admission = columns.admissions[slot];
+            if (!columns.live[slot] || admission == 0) continue;
+            uint32_t discharge = columns.discharges[slot];
+            if (discharge != 0 && discharge <= admission) continue;
+            low = min(low, Date::fromPacked(admission).dayNumber());
+            high = max(high, Date::fromPacked(discharge != 0 ? discharge : admission).dayNumber());
+        }
+        if (low > high) {
+            return;
+        }
+        cover(low, high);
+        for (size_t slot = 0; slot < columns.slotCount(); slot++) {
+            uint32_t admission = columns.admissions[slot];
+            if (!columns.live[slot] || admission == 0) continue;
+            uint32_t discharge = columns.discharges[slot];
+            if (discharge != 0 && discharge <= admission) continue;
+            vector<int32_t>& byDepartment = departmentTree(columns.departments[slot]);
+            size_t start = Date::fromPacked(admission).dayNumber() - firstDay;
+            total[start]++;
+            byDepartment[start]++;
+            if (discharge != 0) {
+                size_t end = Date::fromPacked(discharge).dayNumber() - firstDay;
+                total[end]--;
+                byDepartment[end]--;
+            }
+        }
+        toTree(total);
+        for (auto& tree : departments) {
+            toTree(tree);
+        }
+    }
+
+    // Patients in hospital on day, O(log days).
+    long long activeOn(const Date& day) const {
+        return activeOn(total, day);
+    }
+
+    long long activeOn(const Date& day, uint32_t department) const {
+        return department < departments.size() ? activeOn(departments[department], day) : 0;
+    }
+
+    size_t departmentCount() const {
+        return departments.size();
+    }
+
+    bool operator!=(const CensusTimeline& other) const {
+        if (deltas(total) != other.deltas(other.total)) {
+            return true;
+        }
+        static const vector<int32_t> none;
+        for (size_t code = 0; code < max(departments.size(), other.departments.size()); code++) {
+            const vector<int32_t>& mine = code < departments.size() ? departments[code] : none;
+            const vector<int32_t>& theirs = code < other.departments.size() ? other.departments[code] : none;
+            if (deltas(mine) != other.deltas(theirs)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Per-day occupancy over [from, from + days) for the whole hospital, each
+// department and each room, under the same stay rule as CensusTimeline.
+struct OccupancySeries {
+    Date from;
+    size_t days;
+    vector<uint32_t> total;
+    vector<vector<uint32_t>> departments;  // [department code][day]
+    vector<vector<uint32_t>> rooms;        // [room][day], rooms 1..roomLimit
+    vector<uint32_t> occupiedRooms;        // rooms with at least one patient, per day
+
+    OccupancySeries() : days(0) {}
+};
+
+// Census of one day: patients in hospital, per department code, and rooms
+// with at least one patient.
+struct DayCensus {
+    Date day;
+    long long patients;
+    int occupiedRooms;
+    vector<long long> departments;
+
+    DayCensus() : patients(0), occupiedRooms(0) {}
+};
+
+// Builds the series in a single pass over the columns: each stay adds +1/-1
+// to difference arrays clipped to the window, and one running sum per row
+// turns them into daily counts.
+inline OccupancySeries occupancySeries(const PatientColumns& columns, const Date& from, const Date& to,
+                                       int roomLimit) {
+    OccupancySeries series;
+    series.from = from;
+    if (!from.isValid() || !to.isValid() || to < from) {
+        return series;
+    }
+    int first = from.dayNumber();
+    series.days = static_cast<size_t>(to.dayNumber() - first + 1);
+    size_t width = series.days + 1;  // one extra slot for ends past the window
+    vector<int32_t> total(width, 0);
+    vector<vector<int32_t>> departments(columns.departmentCodes);
+    vector<vector<int32_t>> rooms(roomLimit + 1);
+    int last = first + static_cast<int>(series.days);
+    for (size_t slot = 0; slot < columns.slotCount(); slot++) {
+        uint32_t admission = columns.admissions[slot];
+        if (!columns.live[slot] || admission == 0) continue;
+        uint32_t discharge = columns.discharges[slot];
+        if (discharge != 0 && discharge <= admission) continue;
+        int start = max(first, Date::fromPacked(admission).dayNumber());
+        int end = discharge != 0 ? min(last, Date::fromPacked(discharge).dayNumber()) : last;
+        if (start >= end) continue;
+        size_t a = static_cast<size_t>(start - first);
+        size_t b = static_cast<size_t>(end - first);
+        total[a]++;
+        total[b]--;
+        uint32_t department = columns.departments[slot];
+        if (department >= departments.size()) departments.resize(department + 1);
+        if (departments[department].empty()) departments[department].assign(width, 0);
+        departments[department][a]++;
+        departments[department][b]--;
+        int room = columns.rooms[slot];
+        if (room >= 1 && room <= roomLimit) {
+            if (rooms[room].empty()) rooms[room].assign(width, 0);
+            rooms[room][a]++;
+            rooms[room][b]--;
+        }
+    }
+
+    auto accumulate = [&series](const vector<int32_t>& deltas, vector<uint32_t>& counts) {
+        counts.assign(series.days, 0);
+        if (deltas.empty()) return;
+        int32_t running = 0;
+        for (size_t day = 0; day < series.days; day++) {
+            running += deltas[day];
+            counts[day] = static_cast<uint32_t>(running);
+        }
+    };
+    accumulate(total, series.total);
+    series.departments.resize(departments.size());
+    for (size_t code = 0; code < departments.size(); code++) {
+        accumulate(departments[code], series.departments[code]);
+    }
+    series.rooms.resize(rooms.size());
+    series.occupiedRooms.assign(series.days, 0);
+    for (size_t room = 1; room < rooms.size(); room++) {
+        accumulate(rooms[room], series.rooms[room]);
+        for (size_t day = 0; day < series.days; day++) {
+            series.occupiedRooms[day] += series.rooms[room][day] > 0;
+        }
+    }
+    return series;
+}
+
+// Length of stay and throughput for one group of records (the whole
+// hospital, one department or one condition) over a window of days. Stay
+// lengths go into a CountHistogram, so the quantiles take a few hundred
+// bytes per group however long the history is; stays under 16 days are exact.
+struct StayStats {
+    CountHistogram lengths;      // stays discharged in the window, in days
+    size_t admissions;           // admission date in the window
+    size_t discharges;           // discharge date in the window
+    vector<uint32_t> admitted;   // admissions per period
+    vector<uint32_t> discharged; // discharges per period
+    vector<bool> rooms;          // rooms used by stays overlapping the window
+
+    StayStats() : admissions(0), discharges(0) {}
+
+    void reset(size_t periods, int roomLimit) {
+        lengths.reset();
+        admissions = 0;
+        discharges = 0;
+        admitted.assign(periods, 0);
+        discharged.assign(periods, 0);
+        rooms.assign(roomLimit + 1, false);
+    }
+
+    void merge(const StayStats& other) {
+        lengths.merge(other.lengths);
+        admissions += other.admissions;
+        discharges += other.discharges;
+        for (size_t period = 0; period < admitted.size() && period < other.admitted.size(); period++) {
+            admitted[period] += other.admitted[period];
+            discharged[period] += other.discharged[period];
+        }
+        for (size_t room = 0; room < rooms.size() && room < other.rooms.size(); room++) {
+            if (other.rooms[room]) rooms[room] = true;
+        }
+    }
+
+    size_t roomsUsed() const {
+        return count(rooms.begin(), rooms.end(), true);
+    }
+
+    // Discharges per bed over the window.
+    double turnover(size_t beds) const {
+        return beds ? static_cast<double>(discharges) / beds : 0;
+    }
+};
+
+// Stay analytics over [from, to] in periods of periodDays (1 for daily,
+// 7 for weekly counts), for the hospital and per department and condition
+// code. Partial results over disjoint slot ranges merge by addition.
+struct StayAnalytics {
+    Date from;
+    Date to;
+    int periodDays;
+    size_t periods;
+    int roomLimit;
+    StayStats hospital;
+    vector<StayStats> departments;  // indexed by department code
+    vector<StayStats> conditions;   // indexed by condition code
+
+    StayAnalytics() : periodDays(1), periods(0), roomLimit(0) {}
+
+    void reset(const Date& first, const Date& last, int days, int rooms, size_t departmentCodes,
+               size_t conditionCodes) {
+        from = first;
+        to = last;
+        periodDays = days;
+        periods = from.isValid() && to.isValid() && !(to < from) ? from.daysUntil(to) / days + 1 : 0;
+        roomLimit = rooms;
+        hospital.reset(periods, roomLimit);
+        departments.assign(departmentCodes, hospital);
+        conditions.assign(conditionCodes, hospital);
+    }
+
+    void merge(const StayAnalytics& other) {
+        hospital.merge(other.hospital);
+        for (size_t code = 0; code < departments.size() && code < other.departments.size(); code++) {
+            departments[code].merge(other.departments[code]);
+        }
+        for (size_t code = 0; code < conditions.size() && code < other.conditions.size(); code++) {
+            conditions[code].merge(other.conditions[code]);
+        }
+    }
+
+    Date periodStart(size_t period) const {
+        return from.addDays(static_cast<int>(period) * periodDays);
+    }
+
+    // The hospital has roomLimit beds; a department or condition is
+    // credited with the rooms its stays used.
+    double hospitalTurnover() const {
+        return hospital.turnover(static_cast<size_t>(roomLimit));
+    }
+
+    static double groupTurnover(const StayStats& group) {
+        return group.turnover(group.roomsUsed());
+    }
+};
+
+// Adds slots [begin, end) to analytics, which must already be reset. Each
+// record is looked at once and fed to its three groups.
+inline void accumulateStays(const PatientColumns& columns, size_t begin, size_t end, StayAnalytics& analytics) {
+    if (analytics.periods == 0) {
+        return;
+    }
+    uint32_t first = analytics.from.packed();
+    uint32_t last = analytics.to.packed();
+    int firstDay = analytics.from.dayNumber();
+    for (size_t slot = begin; slot < end; slot++) {
+        if (!columns.live[slot]) continue;
+        StayStats* groups[3] = {&analytics.hospital, nullptr, nullptr};
+        if (columns.departments[slot] < analytics.departments.size()) {
+            groups[1] = &analytics.departments[columns.departments[slot]];
+        }
+        if (columns.conditions[slot] < analytics.conditions.size()) {
+            groups[2] = &analytics.conditions[columns.conditions[slot]];
+        }
+        uint32_t admission = columns.admissions[slot];
+        uint32_t discharge = columns.discharges[slot];
+        int room = columns.rooms[slot];
+        bool admittedIn = admission >= first && admission <= last;
+        bool dischargedIn = discharge >= first && discharge <= last;
+        bool overlaps = admission != 0 && admission <= last && (discharge == 0 || discharge >= first);
+        bool usesRoom = overlaps && room >= 1 && room <= analytics.roomLimit;
+        size_t admittedPeriod = 0, dischargedPeriod = 0;
+        int stay = -1;
+        if (admittedIn) {
+            admittedPeriod = (Date::fromPacked(admission).dayNumber() - firstDay) / analytics.periodDays;
+        }
+        if (dischargedIn) {
+            int dischargeDay = Date::fromPacked(discharge).dayNumber();
+            dischargedPeriod = (dischargeDay - firstDay) / analytics.periodDays;
+            if (admission != 0 && discharge >= admission) {
+                stay = dischargeDay - Date::fromPacked(admission).dayNumber();
+            }
+        }
+        for (StayStats* group : groups) {
+            if (!group) continue;
+            if (admittedIn) {
+                group->admissions++;
+                group->admitted[admittedPeriod]++;
+            }
+            if (dischargedIn) {
+                group->discharges++;
+                group->discharged[dischargedPeriod]++;
+            }
+            if (stay >= 0) group->lengths.record(static_cast<uint64_t>(stay));
+            if (usesRoom) group->rooms[room] = true;
+        }
+    }
+}
+
+// One pass over the columns, split into chunks on the pool like
+// computeStatistics; each chunk fills its own partial and the partials are
+// merged in order.
+inline void analyzeStays(const PatientColumns& columns, const Date& from, const Date& to, int periodDays,
+                         int roomLimit, WorkerPool& pool, StayAnalytics& analytics) {
+    analytics.reset(from, to, periodDays, roomLimit, columns.departmentCodes, columns.conditionCodes);
+    const size_t minChunk = 1 << 16;
+    size_t slots = columns.slotCount();
+    size_t chunks = max<size_t>(1, min(pool.size() * 4, (slots + minChunk - 1) / minChunk));
+    size_t chunkSize = (slots + chunks - 1) / chunks;
+    if (chunks == 1) {
+        accumulateStays(columns, 0, slots, analytics);
+        return;
+    }
+    vector<StayAnalytics> partials(chunks);
+    pool.run(chunks, [&](size_t chunk) {
+        size_t begin = min(slots, chunk * chunkSize);
+        partials[chunk].reset(from, to, periodDays, roomLimit, columns.departmentCodes, columns.conditionCodes);
+        accumulateStays(columns, begin, min(slots, begin + chunkSize), partials[chunk]);
+    });
+    for (const StayAnalytics& partial : partials) {
+        analytics.merge(partial);
+    }
+}
+
+// Append-only log of mutations stored next to the CSV snapshot. Each record
+// is one line: "A,<csv row>", "U,<csv row>" or "D,<id>". Records are flushed
+// to the OS immediately and fsync'd in batches of syncEvery.
+class MutationJournal {
+private:
+    FILE* file;
+    string path;
+    size_t records;
+    size_t unsynced;
+    size_t syncEvery;
+
+public:
+    explicit MutationJournal(size_t syncEvery = 32)
+        : file(nullptr), records(0), unsynced(0), syncEvery(syncEvery) {}
+
+    ~MutationJournal() {
+        close();
+    }
+
+    bool open(const string& journalPath, size_t existingRecords) {
+        close();
+        path = journalPath;
+        file = fopen(path.c_str(), "a+b");
+        records = existingRecords;
+        unsynced = 0;
+        if (!file) {
+            return false;
+        }
+        // A crash can leave a torn final record. Start the next one on a
+        // fresh line, or it would be joined to the torn one and lost on the
+        // next replay.
+        if (fseek(file, -1, SEEK_END) == 0 && fgetc(file) != '\n') {
+            fseek(file, 0, SEEK_END);
+            fputc('\n', file);
+            fflush(file);
+        }
+        fseek(file, 0, SEEK_END);
+        return true;
+    }
+
+    void close() {
+        if (file) {
+            sync();
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool append(char op, const string& payload) {
+        if (!file) {
+            return false;
+        }
+        string line;
+        line.reserve(payload.size() + 3);
+        line += op;
+        line += ',';
+        line += payload;
+        line += '\n';
+        if (fwrite(line.data(), 1, line.size(), file) != line.size() || fflush(file) != 0) {
+            return false;
+        }
+        records++;
+        if (++unsynced >= syncEvery) {
+            sync();
+        }
+        return true;
+    }
+
+    // Writes all payloads with one write and one fsync.
+    bool appendBatch(char op, const vector<string>& payloads) {
+        if (!file) {
+            return false;
+        }
+        string lines;
+        for (const string& payload : payloads) {
+            lines += op;
+            lines += ',';
+            lines += payload;
+            lines += '\n';
+        }
+        if (fwrite(lines.data(), 1, lines.size(), file) != lines.size() || fflush(file) != 0) {
+            return false;
+        }
+        records += payloads.size();
+        unsynced += payloads.size();
+        sync();
+        return true;
+    }
+
+    void sync() {
+        if (!file || unsynced == 0) {
+            return;
+        }
+        syncFile(file);
+        unsynced = 0;
+    }
+
+    // Called once the records have been folded into a new snapshot.
+    bool reset() {
+        close();
+        file = fopen(path.c_str(), "wb");
+        records = 0;
+        return file != nullptr;
+    }
+
+    size_t recordCount() const {
+        return records;
+    }
+
+    const string& getPath() const {
+        return path;
+    }
+};
+
+// Binary snapshot layout (native byte order, every section 4-byte aligned):
+//
+//   SnapshotHeader
+//   int32_t      id[rows]
+//   int32_t      room[rows]
+//   uint32_t     admission[rows]       packed YYYYMMDD, 0 = unset
+//   uint32_t     discharge[rows]
+//   StringSlot   text[rows][4]         name, history, department, condition
+//   uint32_t     byId[rows]            row numbers sorted by id
+//   char         pool[poolBytes]
+//
+// The checksum is FNV-1a over everything after the header. Department and
+// condition values are stored once in the pool and shared between rows.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rows;
+    uint64_t poolBytes;
+    uint64_t checksum;
+};
+
+struct StringSlot {
+    uint32_t offset;
+    uint32_t length;
+};
+
+static const char snapshotMagic[8] = {'H', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t snapshotVersion = 1;
+
+class SnapshotWriter {
+public:
+    template <typename Records>
+    static bool write(const string& path, const Records& records) {
+        if (records.size() > UINT32_MAX) {
+            return false;
+        }
+        uint32_t rows = static_cast<uint32_t>(records.size());
+        vector<int32_t> ids(rows), rooms(rows);
+        vector<uint32_t> admissions(rows), discharges(rows), byId(rows);
+        vector<StringSlot> text(static_cast<size_t>(rows) * 4);
+        string pool;
+        unordered_map<uint64_t, StringSlot> shared;
+
+        auto store = [&pool](StrRef value) {
+            StringSlot slot = {static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(value.size)};
+            pool.append(value.data, value.size);
+            return slot;
+        };
+        // keyed by dictionary (column, code), so each value is pooled once
+        auto storeShared = [&shared, &store](int column, uint32_t code, const string& value) {
+            uint64_t key = (static_cast<uint64_t>(column) << 32) | code;
+            auto it = shared.find(key);
+            if (it != shared.end()) {
+                return it->second;
+            }
+            StringSlot slot = store(value);
+            shared[key] = slot;
+            return slot;
+        };
+
+        uint32_t row = 0;
+        for (const auto& patient : records) {
+            ids[row] = patient.id;
+            rooms[row] = patient.roomNumber;
+            admissions[row] = patient.admissionDate.packed();
+            discharges[row] = patient.dischargeDate.packed();
+            text[row * 4 + 0] = store(patient.name);
+            text[row * 4 + 1] = store(patient.medicalHistory);
+            text[row * 4 + 2] = storeShared(2, patient.departmentCode, patient.department());
+            text[row * 4 + 3] = storeShared(3, patient.conditionCode, patient.condition());
+            byId[row] = row;
+            if (pool.size() > UINT32_MAX) {
+                return false;
+            }
+            row++;
+        }
+        sort(byId.begin(), byId.end(), [&ids](uint32_t a, uint32_t b) {
+            return ids[a] < ids[b];
+        });
+
+        string body;
+        body.reserve(rows * (sizeof(int32_t) * 2 + sizeof(uint32_t) * 3 + sizeof(StringSlot) * 4) + pool.size());
+        appendColumn(body, ids);
+        appendColumn(body, rooms);
+        appendColumn(body, admissions);
+        appendColumn(body, discharges);
+        appendColumn(body, text);
+        appendColumn(body, byId);
+        body += pool;
+
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+        header.version = snapshotVersion;
+        header.rows = rows;
+        header.poolBytes = pool.size();
+        header.checksum = fnv1a(body.data(), body.size());
+
+        AtomicFile file(path);
+        if (!file.isOpen()) {
+            return false;
+        }
+        file.write(&header, sizeof(header));
+        file.write(body.data(), body.size());
+        return file.commit();
+    }
+
+private:
+    template <typename T>
+    static void appendColumn(string& body, const vector<T>& column) {
+        if (!column.empty()) {
+            body.append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+        }
+    }
+};
+
+// Serves a snapshot straight from the mapped file: columns are read in
+// place and a Patient is only built for the rows a caller asks for.
+class SnapshotReader {
+private:
+    MappedFile file;
+    uint32_t rows;
+    const int32_t* ids;
+    const int32_t* rooms;
+    const uint32_t* admissions;
+    const uint32_t* discharges;
+    const StringSlot* text;
+    const uint32_t* byId;
+    const char* pool;
+    string error;
+
+    StrRef field(uint32_t row, int column) const {
+        const StringSlot& slot = text[static_cast<size_t>(row) * 4 + column];
+        return StrRef(pool + slot.offset, slot.length);
+    }
+
+public:
+    SnapshotReader() : rows(0), ids(nullptr), rooms(nullptr), admissions(nullptr),
+                       discharges(nullptr), text(nullptr), byId(nullptr), pool(nullptr) {}
+
+    static bool isSnapshot(const string& path) {
+        char magic[sizeof(snapshotMagic)];
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        bool match = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                     memcmp(magic, snapshotMagic, sizeof(magic)) == 0;
+        fclose(file);
+        return match;
+    }
+
+    bool open(const string& path) {
+        if (!file.open(path)) {
+            error = "cannot open " + path;
+            return false;
+        }
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) {
+            error = "file too short";
+            return false;
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0) {
+            error = "not a snapshot file";
+            return false;
+        }
+        if (header.version != snapshotVersion) {
+            error = "unsupported snapshot version " + to_string(header.version);
+            return false;
+        }
+        uint64_t columnBytes = static_cast<uint64_t>(header.rows) *
+            (sizeof(int32_t) * 2 + sizeof(uint32_t) * 3 + sizeof(StringSlot) * 4);
+        if (file.size() - sizeof(header) != columnBytes + header.poolBytes) {
+            error = "size does not match header";
+            return false;
+        }
+        const char* body = file.data() + sizeof(header);
+        if (fnv1a(body, file.size() - sizeof(header)) != header.checksum) {
+            error = "checksum mismatch";
+            return false;
+        }
+
+        rows = header.rows;
+        ids = reinterpret_cast<const int32_t*>(body);
+        rooms = ids + rows;
+        admissions = reinterpret_cast<const uint32_t*>(rooms + rows);
+        discharges = admissions + rows;
+        text = reinterpret_cast<const StringSlot*>(discharges + rows);
+        byId = reinterpret_cast<const uint32_t*>(text + static_cast<size_t>(rows) * 4);
+        pool = reinterpret_cast<const char*>(byId + rows);
+        for (size_t i = 0; i < static_cast<size_t>(rows) * 4; i++) {
+            if (static_cast<uint64_t>(text[i].offset) + text[i].length > header.poolBytes) {
+                error = "string slot out of range";
+                rows = 0;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const string& lastError() const {
+        return error;
+    }
+
+    uint32_t rowCount() const {
+        return rows;
+    }
+
+    int id(uint32_t row) const {
+        return ids[row];
+    }
+
+    int roomNumber(uint32_t row) const {
+        return rooms[row];
+    }
+
+    Date admissionDate(uint32_t row) const {
+        return Date::fromPacked(admissions[row]);
+    }
+
+    Date dischargeDate(uint32_t row) const {
+        return Date::fromPacked(discharges[row]);
+    }
+
+    StrRef name(uint32_t row) const { return field(row, 0); }
+    StrRef medicalHistory(uint32_t row) const { return field(row, 1); }
+    StrRef department(uint32_t row) const { return field(row, 2); }
+    StrRef condition(uint32_t row) const { return field(row, 3); }
+
+    // Binary search over the id-sorted row list; returns -1 if absent.
+    long long findById(int id) const {
+        const uint32_t* first = byId;
+        const uint32_t* last = byId + rows;
+        const int32_t* idColumn = ids;
+        const uint32_t* it = lower_bound(first, last, id, [idColumn](uint32_t row, int key) {
+            return idColumn[row] < key;
+        });
+        if (it == last || ids[*it] != id) {
+            return -1;
+        }
+        return *it;
+    }
+
+    Patient materialize(uint32_t row) const {
+        return Patient(ids[row], name(row).str(), medicalHistory(row).str(), department(row).str(),
+                       condition(row).str(), admissionDate(row), dischargeDate(row), rooms[row]);
+    }
+
+    // Same, with the text copied straight from the mapping into text.
+    PatientRecord materialize(uint32_t row, TextArena& text, CodeCache& cache) const {
+        PatientRecord record;
+        record.id = ids[row];
+        record.name = text.store(name(row));
+        record.medicalHistory = text.store(medicalHistory(row));
+        record.departmentCode = cache.departments.intern(department(row));
+        record.conditionCode = cache.conditions.intern(condition(row));
+        record.admissionDate = admissionDate(row);
+        record.dischargeDate = dischargeDate(row);
+        record.roomNumber = rooms[row];
+        record.dictionaries = &cache.codes;
+        return record;
+    }
+};
+
+// Ordered secondary index over one date column: (date, record index) pairs
+// kept sorted, so a range query is a binary search plus a contiguous walk.
+// Unset dates are not indexed.
+class DateIndex {
+private:
+    typedef pair<uint32_t, int> Entry;
+    vector<Entry> entries;
+
+public:
+    void clear() {
+        entries.clear();
+    }
+
+    void insert(const Date& date, int idx) {
+        if (!date.isValid()) {
+            return;
+        }
+        Entry entry(date.packed(), idx);
+        entries.insert(lower_bound(entries.begin(), entries.end(), entry), entry);
+    }
+
+    void erase(const Date& date, int idx) {
+        if (!date.isValid()) {
+            return;
+        }
+        Entry entry(date.packed(), idx);
+        auto it = lower_bound(entries.begin(), entries.end(), entry);
+        if (it != entries.end() && *it == entry) {
+            entries.erase(it);
+        }
+    }
+
+    // Adds (date, record index) pairs in any order with one sort of the new
+    // entries and one merge into the existing ones.
+    void insertBatch(const vector<pair<Date, int>>& dates) {
+        size_t existing = entries.size();
+        for (const auto& date : dates) {
+            if (date.first.isValid()) {
+                entries.push_back(Entry(date.first.packed(), date.second));
+            }
+        }
+        sort(entries.begin() + existing, entries.end());
+        inplace_merge(entries.begin(), entries.begin() + existing, entries.end());
+    }
+
+    // Bulk build from (date, record index) pairs in any order.
+    void build(const vector<pair<Date, int>>& dates) {
+        entries.clear();
+        for (const auto& date : dates) {
+            if (date.first.isValid()) {
+                entries.push_back(Entry(date.first.packed(), date.second));
+            }
+        }
+        sort(entries.begin(), entries.end());
+    }
+
+    // Record indices with from <= date <= to, in date order.
+    vector<int> range(const Date& from, const Date& to) const {
+        vector<int> result;
+        auto first = lower_bound(entries.begin(), entries.end(), Entry(from.packed(), INT_MIN));
+        for (auto it = first; it != entries.end() && it->first <= to.packed(); ++it) {
+            result.push_back(it->second);
+        }
+        return result;
+    }
+
+    vector<int> on(const Date& date) const {
+        return range(date, date);
+    }
+
+    size_t countInRange(const Date& from, const Date& to) const {
+        auto first = lower_bound(entries.begin(), entries.end(), Entry(from.packed(), INT_MIN));
+        auto last = upper_bound(entries.begin(), entries.end(), Entry(to.packed(), INT_MAX));
+        return first < last ? last - first : 0;
+    }
+
+    // Earliest and latest dates indexed; invalid when empty.
+    Date first() const {
+        return entries.empty() ? Date() : Date::fromPacked(entries.front().first);
+    }
+
+    Date last() const {
+        return entries.empty() ? Date() : Date::fromPacked(entries.back().first);
+    }
+
+    bool operator==(const DateIndex& other) const {
+        return entries == other.entries;
+    }
+
+    bool operator!=(const DateIndex& other) const {
+        return !(*this == other);
+    }
+};
+
+// Per-room schedule of stays over [admissionDate, dischargeDate), where an
+// unset discharge date means the stay is still open. Each room keeps its
+// closed stays sorted by start with a running maximum of end dates, and its
+// open stays in a separate start-sorted list, since one open stay would pin
+// the running maximum for the rest of the room's history. An open stay
+// covers every day from its start, so counting those is one binary search;
+// closed stays are found by a binary search and a walk back that ends one
+// stay past the last overlap when the room's closed stays do not overlap
+// each other (validation keeps them apart). Occupants per room on the
+// current day are cached and updated on every insert/erase.
+class RoomOccupancyIndex {
+private:
+    struct Stay {
+        uint32_t start;
+        uint32_t end;
+        int idx;
+
+        bool operator<(const Stay& other) const {
+            return start != other.start ? start < other.start : idx < other.idx;
+        }
+
+        bool operator==(const Stay& other) const {
+            return start == other.start && end == other.end && idx == other.idx;
+        }
+    };
+
+    struct Schedule {
+        vector<Stay> stays;       // closed stays
+        vector<uint32_t> maxEnd;  // maxEnd[i] = max end over stays[0..i]
+        vector<Stay> open;        // stays without a discharge date
+    };
+
+    static const uint32_t openEnded = UINT32_MAX;
+
+    vector<Schedule> rooms;
+    vector<int> occupantsToday;
+    int roomLimit;
+    int occupiedToday;
+    uint32_t today;
+
+    static bool toStay(const Date& admission, const Date& discharge, int idx, Stay& stay) {
+        if (!admission.isValid()) {
+            return false;
+        }
+        stay.start = admission.packed();
+        stay.end = discharge.isValid() ? discharge.packed() : openEnded;
+        stay.idx = idx;
+        return stay.start < stay.end;
+    }
+
+    static void refreshMaxEnd(Schedule& schedule, size_t from) {
+        schedule.maxEnd.resize(schedule.stays.size());
+        for (size_t i = from; i < schedule.stays.size(); i++) {
+            uint32_t previous = i == 0 ? 0 : schedule.maxEnd[i - 1];
+            schedule.maxEnd[i] = max(previous, schedule.stays[i].end);
+        }
+    }
+
+    const Schedule* schedule(int room) const {
+        if (room < 0 || room >= static_cast<int>(rooms.size())) {
+            return nullptr;
+        }
+        return &rooms[room];
+    }
+
+    // Number of stays in a start-sorted list that start before key.
+    static size_t startingBefore(const vector<Stay>& stays, uint32_t key) {
+        return lower_bound(stays.begin(), stays.end(), key,
+            [](const Stay& stay, uint32_t value) { return stay.start < value; }) - stays.begin();
+    }
+
+    // True if any stay in room, other than the one of record skip, overlaps
+    // the half-open key range [from, until).
+    bool overlaps(int room, uint32_t from, uint32_t until, int skip = -1) const {
+        const Schedule* target = schedule(room);
+        if (!target) {
+            return false;
+        }
+        // open stays reach past any from, so they overlap if they start before until
+        size_t openBefore = startingBefore(target->open, until);
+        if (openBefore > 1 || (openBefore == 1 && target->open[0].idx != skip)) {
+            return true;
+        }
+        size_t startsBefore = startingBefore(target->stays, until);
+        if (startsBefore == 0 || target->maxEnd[startsBefore - 1] <= from) {
+            return false;
+        }
+        if (skip < 0) {
+            return true;
+        }
+        // walk back while an earlier stay may still reach past from
+        for (size_t i = startsBefore; i > 0 && target->maxEnd[i - 1] > from; i--) {
+            const Stay& stay = target->stays[i - 1];
+            if (stay.end > from && stay.idx != skip) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool coversToday(const Stay& stay) const {
+        return stay.start <= today && today < stay.end;
+    }
+
+    void adjustToday(int room, int delta) {
+        if (room >= static_cast<int>(occupantsToday.size())) {
+            occupantsToday.resize(room + 1, 0);
+        }
+        int before = occupantsToday[room];
+        occupantsToday[room] += delta;
+        if (room >= 1 && room <= roomLimit) {
+            if (before == 0 && occupantsToday[room] > 0) occupiedToday++;
+            if (before > 0 && occupantsToday[room] == 0) occupiedToday--;
+        }
+    }
+
+public:
+    explicit RoomOccupancyIndex(int roomLimit = 200)
+        : roomLimit(roomLimit), occupiedToday(0), today(Date::today().packed()) {}
+
+    void clear() {
+        rooms.clear();
+        occupantsToday.clear();
+        occupiedToday = 0;
+    }
+
+    void insert(int room, const Date& admission, const Date& discharge, int idx) {
+        Stay stay;
+        if (room < 0 || !toStay(admission, discharge, idx, stay)) {
+            return;
+        }
+        if (room >= static_cast<int>(rooms.size())) {
+            rooms.resize(room + 1);
+        }
+        Schedule& target = rooms[room];
+        if (stay.end == openEnded) {
+            target.open.insert(lower_bound(target.open.begin(), target.open.end(), stay), stay);
+        } else {
+            auto pos = lower_bound(target.stays.begin(), target.stays.end(), stay);
+            size_t offset = pos - target.stays.begin();
+            target.stays.insert(pos, stay);
+            refreshMaxEnd(target, offset);
+        }
+        if (coversToday(stay)) {
+            adjustToday(room, 1);
+        }
+    }
+
+    struct StayRecord {
+        int room;
+        Date admission;
+        Date discharge;
+        int idx;
+    };
+
+    // Appends every stay first, then sorts and merges each touched room once
+    // instead of shifting its schedule per insert.
+    void insertBatch(const vector<StayRecord>& records) {
+        unordered_map<int, pair<size_t, size_t>> existing;   // closed and open stays before the batch
+        for (const StayRecord& record : records) {
+            Stay stay;
+            if (record.room < 0 || !toStay(record.admission, record.discharge, record.idx, stay)) {
+                continue;
+            }
+            if (record.room >= static_cast<int>(rooms.size())) {
+                rooms.resize(record.room + 1);
+            }
+            Schedule& target = rooms[record.room];
+            existing.emplace(record.room, make_pair(target.stays.size(), target.open.size()));
+            (stay.end == openEnded ? target.open : target.stays).push_back(stay);
+            if (coversToday(stay)) {
+                adjustToday(record.room, 1);
+            }
+        }
+        for (const auto& touched : existing) {
+            Schedule& target = rooms[touched.first];
+            sort(target.stays.begin() + touched.second.first, target.stays.end());
+            inplace_merge(target.stays.begin(), target.stays.begin() + touched.second.first, target.stays.end());
+            sort(target.open.begin() + touched.second.second, target.open.end());
+            inplace_merge(target.open.begin(), target.open.begin() + touched.second.second, target.open.end());
+            refreshMaxEnd(target, 0);
+        }
+    }
+
+    void erase(int room, const Date& admission, const Date& discharge, int idx) {
+        Stay stay;
+        if (room < 0 || room >= static_cast<int>(rooms.size()) ||
+            !toStay(admission, discharge, idx, stay)) {
+            return;
+        }
+        Schedule& target = rooms[room];
+        vector<Stay>& stays = stay.end == openEnded ? target.open : target.stays;
+        auto pos = lower_bound(stays.begin(), stays.end(), stay);
+        if (pos == stays.end() || !(*pos == stay)) {
+            return;
+        }
+        size_t offset = pos - stays.begin();
+        stays.erase(pos);
+        if (stay.end != openEnded) {
+            refreshMaxEnd(target, offset);
+        }
+        if (coversToday(stay)) {
+            adjustToday(room, -1);
+        }
+    }
+
+    // Recounts today's occupants for every room; day rollovers use the
+    // incremental overload below.
+    void setToday(const Date& day) {
+        today = day.packed();
+        occupantsToday.assign(rooms.size(), 0);
+        occupiedToday = 0;
+        for (size_t room = 0; room < rooms.size(); room++) {
+            for (const vector<Stay>* stays : {&rooms[room].stays, &rooms[room].open}) {
+                for (const Stay& stay : *stays) {
+                    if (coversToday(stay)) {
+                        adjustToday(room, 1);
+                    }
+                }
+            }
+        }
+    }
+
+    // Day rollover. Only stays that start or end in (earlier day, later
+    // day] change sides, and the caller hands over just those (found with
+    // the date indices, each record once), so the cost is independent of
+    // the number of stays.
+    void setToday(const Date& day, const vector<StayRecord>& changed) {
+        for (const StayRecord& record : changed) {
+            Stay stay;
+            if (record.room >= 0 && toStay(record.admission, record.discharge, record.idx, stay) &&
+                coversToday(stay)) {
+                adjustToday(record.room, -1);
+            }
+        }
+        today = day.packed();
+        for (const StayRecord& record : changed) {
+            Stay stay;
+            if (record.room >= 0 && toStay(record.admission, record.discharge, record.idx, stay) &&
+                coversToday(stay)) {
+                adjustToday(record.room, 1);
+            }
+        }
+    }
+
+    Date getToday() const {
+        return Date::fromPacked(today);
+    }
+
+    bool isFreeOn(int room, const Date& day) const {
+        return !overlaps(room, day.packed(), day.packed() + 1);
+    }
+
+    // Free for the whole stay [from, until); an unset until means open-ended.
+    // The stay of record ignoredIdx, if given, does not count (for edits).
+    bool isFreeFor(int room, const Date& from, const Date& until, int ignoredIdx = -1) const {
+        return !overlaps(room, from.packed(), until.isValid() ? until.packed() : openEnded, ignoredIdx);
+    }
+
+    // The cached count for the current day. Other days count the open
+    // stays starting by day with one binary search, then find the closed
+    // stays starting by day and walk back until the running maximum end
+    // shows no earlier stay reaches the day.
+    int occupantsOn(int room, const Date& day) const {
+        uint32_t key = day.packed();
+        if (key == today) {
+            return room >= 0 && room < static_cast<int>(occupantsToday.size()) ? occupantsToday[room] : 0;
+        }
+        const Schedule* target = schedule(room);
+        if (!target) {
+            return 0;
+        }
+        int count = static_cast<int>(startingBefore(target->open, key + 1));
+        for (size_t i = startingBefore(target->stays, key + 1); i > 0 && target->maxEnd[i - 1] > key; i--) {
+            if (target->stays[i - 1].end > key) count++;
+        }
+        return count;
+    }
+
+    int occupiedRoomsToday() const {
+        return occupiedToday;
+    }
+
+    // Every pair of stays that share a room on at least one day, found with
+    // a sweep over each room's start-sorted stays.
+    vector<pair<int, int>> overlappingStays() const {
+        vector<pair<int, int>> result;
+        vector<Stay> active;
+        vector<Stay> stays;
+        for (const Schedule& schedule : rooms) {
+            active.clear();
+            stays.clear();
+            merge(schedule.stays.begin(), schedule.stays.end(), schedule.open.begin(), schedule.open.end(),
+                  back_inserter(stays));
+            for (const Stay& stay : stays) {
+                active.erase(remove_if(active.begin(), active.end(),
+                    [&stay](const Stay& open) { return open.end <= stay.start; }), active.end());
+                for (const Stay& open : active) {
+                    result.push_back(make_pair(open.idx, stay.idx));
+                }
+                active.push_back(stay);
+            }
+        }
+        return result;
+    }
+
+    bool operator==(const RoomOccupancyIndex& other) const {
+        static const Schedule empty = Schedule();
+        size_t count = max(rooms.size(), other.rooms.size());
+        for (size_t room = 0; room < count; room++) {
+            const Schedule* left = schedule(room);
+            const Schedule* right = other.schedule(room);
+            left = left ? left : &empty;
+            right = right ? right : &empty;
+            if (left->stays != right->stays || left->open != right->open) {
+                return false;
+            }
+        }
+        return occupiedToday == other.occupiedToday;
+    }
+
+    bool operator!=(const RoomOccupancyIndex& other) const {
+        return !(*this == other);
+    }
+};
+
+// Intersects two sorted posting lists. The shorter list drives and the
+// longer one is searched by galloping, so cost grows with the smaller side.
+inline vector<int> intersectPostings(const vector<int>& left, const vector<int>& right) {
+    const vector<int>& small = left.size() <= right.size() ? left : right;
+    const vector<int>& large = left.size() <= right.size() ? right : left;
+    vector<int> result;
+    size_t base = 0;
+    for (int value : small) {
+        size_t step = 1;
+        size_t hi = base;
+        while (hi < large.size() && large[hi] < value) {
+            base = hi;
+            hi += step;
+            step *= 2;
+        }
+        auto it = lower_bound(large.begin() + base, large.begin() + min(hi + 1, large.size()), value);
+        base = it - large.begin();
+        if (base == large.size()) {
+            break;
+        }
+        if (*it == value) {
+            result.push_back(value);
+        }
+    }
+    return result;
+}
+
+// Trigram index over case-folded patient names. Each name is folded and
+// stored once, by record index. Substring queries intersect the posting
+// lists of the query's trigrams (smallest first) and verify the few
+// survivors against the folded name; prefix queries binary-search the record
+// indices kept in folded-name order. Queries shorter than three characters
+// fall back to a scan of the folded names.
+class NameIndex {
+private:
+    unordered_map<uint32_t, vector<int>> postings;
+    vector<string> foldedNames;   // by record index; empty when not indexed
+    vector<int> byName;           // indexed records ordered by (folded name, index)
+
+    static uint32_t trigram(const string& text, size_t pos) {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(text[pos])) << 16) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(text[pos + 1])) << 8) |
+               static_cast<uint32_t>(static_cast<unsigned char>(text[pos + 2]));
+    }
+
+    static vector<uint32_t> trigramsOf(const string& folded) {
+        vector<uint32_t> grams;
+        for (size_t pos = 0; pos + 3 <= folded.size(); pos++) {
+            grams.push_back(trigram(folded, pos));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    bool isIndexed(int idx) const {
+        return idx >= 0 && idx < static_cast<int>(foldedNames.size()) && !foldedNames[idx].empty();
+    }
+
+    bool nameOrder(int left, int right) const {
+        int order = foldedNames[left].compare(foldedNames[right]);
+        return order != 0 ? order < 0 : left < right;
+    }
+
+    // Stores the folded name and its trigram postings; false if it is empty.
+    bool add(int idx, StrRef name) {
+        string folded = foldCase(name);
+        if (folded.empty()) {
+            return false;
+        }
+        if (idx >= static_cast<int>(foldedNames.size())) {
+            foldedNames.resize(idx + 1);
+        }
+        for (uint32_t gram : trigramsOf(folded)) {
+            vector<int>& list = postings[gram];
+            list.insert(lower_bound(list.begin(), list.end(), idx), idx);
+        }
+        foldedNames[idx].swap(folded);
+        return true;
+    }
+
+public:
+    void clear() {
+        postings.clear();
+        foldedNames.clear();
+        byName.clear();
+    }
+
+    void insert(int idx, StrRef name) {
+        if (add(idx, name)) {
+            byName.insert(lower_bound(byName.begin(), byName.end(), idx,
+                [this](int left, int right) { return nameOrder(left, right); }), idx);
+        }
+    }
+
+    // Adds (record index, name) pairs with one sort of the new entries and
+    // one merge into the name order.
+    void insertBatch(const vector<pair<int, StrRef>>& names) {
+        size_t existing = byName.size();
+        for (const auto& name : names) {
+            if (add(name.first, name.second)) {
+                byName.push_back(name.first);
+            }
+        }
+        auto order = [this](int left, int right) { return nameOrder(left, right); };
+        sort(byName.begin() + existing, byName.end(), order);
+        inplace_merge(byName.begin(), byName.begin() + existing, byName.end(), order);
+    }
+
+    void erase(int idx) {
+        if (!isIndexed(idx)) {
+            return;
+        }
+        const string& folded = foldedNames[idx];
+        for (uint32_t gram : trigramsOf(folded)) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) continue;
+            vector<int>& list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), idx);
+            if (pos != list.end() && *pos == idx) list.erase(pos);
+            if (list.empty()) postings.erase(it);
+        }
+        auto pos = lower_bound(byName.begin(), byName.end(), idx,
+            [this](int left, int right) { return nameOrder(left, right); });
+        if (pos != byName.end() && *pos == idx) byName.erase(pos);
+        string().swap(foldedNames[idx]);
+    }
+
+    // Record indices whose name contains query (case-insensitive), sorted.
+    vector<int> containing(const string& query) const {
+        string folded = foldCase(query);
+        vector<int> result;
+        if (folded.size() < 3) {
+            for (size_t idx = 0; idx < foldedNames.size(); idx++) {
+                if (!foldedNames[idx].empty() && foldedNames[idx].find(folded) != string::npos) {
+                    result.push_back(idx);
+                }
+            }
+            return result;
+        }
+
+        vector<const vector<int>*> lists;
+        for (uint32_t gram : trigramsOf(folded)) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) {
+                return result;
+            }
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(), [](const vector<int>* a, const vector<int>* b) {
+            return a->size() < b->size();
+        });
+        vector<int> candidates = *lists[0];
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            candidates = intersectPostings(candidates, *lists[i]);
+        }
+        for (int idx : candidates) {
+            if (foldedNames[idx].find(folded) != string::npos) {
+                result.push_back(idx);
+            }
+        }
+        return result;
+    }
+
+    // Size of the shortest trigram posting list for query, an upper bound
+    // on containing(query).size(); -1 if the query is too short to index.
+    long long estimateContaining(const string& query) const {
+        string folded = foldCase(query);
+        if (folded.size() < 3) {
+            return -1;
+        }
+        long long best = LLONG_MAX;
+        for (uint32_t gram : trigramsOf(folded)) {
+            auto it = postings.find(gram);
+            best = min<long long>(best, it == postings.end() ? 0 : it->second.size());
+        }
+        return best;
+    }
+
+    // Record indices whose name starts with prefix, in name order.
+    vector<int> withPrefix(const string& prefix) const {
+        string folded = foldCase(prefix);
+        vector<int> result;
+        auto it = lower_bound(byName.begin(), byName.end(), folded,
+            [this](int idx, const string& key) { return foldedNames[idx] < key; });
+        for (; it != byName.end() && foldedNames[*it].compare(0, folded.size(), folded) == 0; ++it) {
+            result.push_back(*it);
+        }
+        return result;
+    }
+
+    // Typo-tolerant lookup: records sharing at least half of the query's
+    // trigrams, best matches first.
+    vector<int> similarTo(const string& query, size_t limit) const {
+        vector<uint32_t> grams = trigramsOf(foldCase(query));
+        unordered_map<int, int> shared;
+        for (uint32_t gram : grams) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) continue;
+            for (int idx : it->second) {
+                shared[idx]++;
+            }
+        }
+        vector<pair<int, int>> ranked;
+        for (const auto& entry : shared) {
+            if (entry.second * 2 >= static_cast<int>(grams.size())) {
+                ranked.push_back(make_pair(-entry.second, entry.first));
+            }
+        }
+        sort(ranked.begin(), ranked.end());
+        vector<int> result;
+        for (size_t i = 0; i < ranked.size() && i < limit; i++) {
+            result.push_back(ranked[i].second);
+        }
+        return result;
+    }
+
+    bool operator==(const NameIndex& other) const {
+        if (postings != other.postings || byName != other.byName) {
+            return false;
+        }
+        for (int idx : byName) {
+            if (foldedNames[idx] != other.foldedNames[idx]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(const NameIndex& other) const {
+        return !(*this == other);
+    }
+};
+
+enum QueryField {
+    QueryId,
+    QueryName,
+    QueryDepartment,
+    QueryCondition,
+    QueryRoom,
+    QueryAdmitted,
+    QueryDischarged,
+    QueryActive
+};
+
+// One field predicate. Id and room compare against [low, high]; dates
+// against [from, to]; name is a case-insensitive substring; department and
+// condition are exact (case-insensitive) matches; active means in a room on
+// day "from".
+struct QueryPredicate {
+    QueryField field;
+    int low;
+    int high;
+    Date from;
+    Date to;
+    string text;
+
+    QueryPredicate(QueryField field) : field(field), low(0), high(0) {}
+
+    static QueryPredicate idIs(int id) {
+        QueryPredicate predicate(QueryId);
+        predicate.low = predicate.high = id;
+        return predicate;
+    }
+
+    static QueryPredicate nameContains(const string& text) {
+        QueryPredicate predicate(QueryName);
+        predicate.text = text;
+        return predicate;
+    }
+
+    static QueryPredicate departmentIs(const string& department) {
+        QueryPredicate predicate(QueryDepartment);
+        predicate.text = department;
+        return predicate;
+    }
+
+    static QueryPredicate conditionIs(const string& condition) {
+        QueryPredicate predicate(QueryCondition);
+        predicate.text = condition;
+        return predicate;
+    }
+
+    static QueryPredicate roomIs(int room) {
+        QueryPredicate predicate(QueryRoom);
+        predicate.low = predicate.high = room;
+        return predicate;
+    }
+
+    static QueryPredicate admittedBetween(const Date& from, const Date& to) {
+        QueryPredicate predicate(QueryAdmitted);
+        predicate.from = from;
+        predicate.to = to;
+        return predicate;
+    }
+
+    static QueryPredicate dischargedBetween(const Date& from, const Date& to) {
+        QueryPredicate predicate(QueryDischarged);
+        predicate.from = from;
+        predicate.to = to;
+        return predicate;
+    }
+
+    static QueryPredicate activeOn(const Date& day) {
+        QueryPredicate predicate(QueryActive);
+        predicate.from = day;
+        return predicate;
+    }
+};
+
+// A conjunction (or, with matchAny, a disjunction) of field predicates.
+//
+// Text form, terms separated by spaces, values with spaces in double quotes:
+//   department=Cardiology condition=Critical admitted=01-03-2025..31-03-2025 active
+//   name=smith or room=101
+// Fields: id, name, department, condition, room, admitted, discharged, active[=DATE].
+struct PatientQuery {
+    vector<QueryPredicate> terms;
+    bool matchAny;
+
+    PatientQuery() : matchAny(false) {}
+
+    static bool parseDateRange(const string& value, Date& from, Date& to) {
+        size_t dots = value.find("..");
+        from = Date(value.substr(0, dots));
+        to = dots == string::npos ? from : Date(value.substr(dots + 2));
+        return from.isValid() && to.isValid();
+    }
+
+    static bool parse(const string& text, PatientQuery& query, string& error) {
+        query = PatientQuery();
+        bool sawAnd = false;
+        bool sawOr = false;
+        size_t pos = 0;
+        while (pos < text.size()) {
+            if (isspace(static_cast<unsigned char>(text[pos]))) {
+                pos++;
+                continue;
+            }
+            string token;
+            bool quoted = false;
+            while (pos < text.size() && (quoted || !isspace(static_cast<unsigned char>(text[pos])))) {
+                if (text[pos] == '"') {
+                    quoted = !quoted;
+                } else {
+                    token += text[pos];
+                }
+                pos++;
+            }
+
+            string lowered = foldCase(token);
+            if (lowered == "and") {
+                sawAnd = true;
+                continue;
+            }
+            if (lowered == "or") {
+                sawOr = true;
+                continue;
+            }
+
+            size_t equals = token.find('=');
+            string field = foldCase(token.substr(0, equals));
+            string value = equals == string::npos ? "" : token.substr(equals + 1);
+            try {
+                if (field == "id") {
+                    query.terms.push_back(QueryPredicate::idIs(stoi(value)));
+                } else if (field == "name") {
+                    query.terms.push_back(QueryPredicate::nameContains(value));
+                } else if (field == "department") {
+                    query.terms.push_back(QueryPredicate::departmentIs(value));
+                } else if (field == "condition") {
+                    query.terms.push_back(QueryPredicate::conditionIs(value));
+                } else if (field == "room") {
+                    query.terms.push_back(QueryPredicate::roomIs(stoi(value)));
+                } else if (field == "admitted" || field == "discharged") {
+                    Date from, to;
+                    if (!parseDateRange(value, from, to)) {
+                        error = "Expected " + field + "=DD-MM-YYYY or DD-MM-YYYY..DD-MM-YYYY";
+                        return false;
+                    }
+                    query.terms.push_back(field == "admitted" ? QueryPredicate::admittedBetween(from, to)
+                                                              : QueryPredicate::dischargedBetween(from, to));
+                } else if (field == "active") {
+                    query.terms.push_back(QueryPredicate::activeOn(value.empty() ? Date::today() : Date(value)));
+                } else {
+                    error = "Unknown field '" + field + "'";
+                    return false;
+                }
+            } catch (const exception& e) {
+                error = "Invalid value in '" + token + "'";
+                return false;
+            }
+        }
+        if (sawAnd && sawOr) {
+            error = "Mixing 'and' with 'or' is not supported";
+            return false;
+        }
+        if (query.terms.empty()) {
+            error = "Empty query";
+            return false;
+        }
+        query.matchAny = sawOr;
+        return true;
+    }
+};
+
+enum IngestFormat { IngestCSV, IngestNDJSON };
+
+struct IngestReject {
+    size_t row;       // 1-based line in the feed, or position in the batch
+    int id;           // 0 if the row could not be parsed
+    string reason;
+};
+
+struct IngestReport {
+    size_t accepted;
+    vector<IngestReject> rejects;
+
+    IngestReport() : accepted(0) {}
+};
+
+// Reads one flat JSON object with the Patient field names as keys:
+//   {"id": 0, "name": "Jane Doe", "medicalHistory": "Asthma", "department": "ENT",
+//    "condition": "Stable", "admissionDate": "01-10-2025", "dischargeDate": null, "roomNumber": 12}
+// Missing keys keep their defaults (id 0 = assign, empty strings, unset dates).
+inline bool parsePatientJson(const string& line, Patient& patient, string& error) {
+    size_t pos = 0;
+    auto skipSpace = [&]() {
+        while (pos < line.size() && isspace(static_cast<unsigned char>(line[pos]))) pos++;
+    };
+    auto readString = [&](string& out) -> bool {
+        if (pos >= line.size() || line[pos] != '"') return false;
+        pos++;
+        out.clear();
+        while (pos < line.size() && line[pos] != '"') {
+            char c = line[pos++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= line.size()) return false;
+            char escaped = line[pos++];
+            switch (escaped) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    if (pos + 4 > line.size()) return false;
+                    unsigned code = static_cast<unsigned>(strtoul(line.substr(pos, 4).c_str(), nullptr, 16));
+                    pos += 4;
+                    if (code < 0x80) {
+                        out += static_cast<char>(code);
+                    } else if (code < 0x800) {
+                        out += static_cast<char>(0xC0 | (code >> 6));
+                        out += static_cast<char>(0x80 | (code & 0x3F));
+                    } else {
+                        out += static_cast<char>(0xE0 | (code >> 12));
+                        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                        out += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                default: out += escaped; break;
+            }
+        }
+        if (pos >= line.size()) return false;
+        pos++;
+        return true;
+    };
+
+    string name, history, department, condition, admission, discharge;
+    int id = 0;
+    int room = 0;
+    skipSpace();
+    if (pos >= line.size() || line[pos] != '{') {
+        error = "Expected a JSON object";
+        return false;
+    }
+    pos++;
+    skipSpace();
+    bool first = true;
+    while (pos < line.size() && line[pos] != '}') {
+        if (!first) {
+            if (line[pos] != ',') break;
+            pos++;
+            skipSpace();
+        }
+        first = false;
+        string key;
+        if (!readString(key)) break;
+        skipSpace();
+        if (pos >= line.size() || line[pos] != ':') break;
+        pos++;
+        skipSpace();
+
+        string text;
+        bool isNull = false;
+        long long number = 0;
+        bool isNumber = false;
+        if (pos < line.size() && line[pos] == '"') {
+            if (!readString(text)) break;
+        } else if (line.compare(pos, 4, "null") == 0) {
+            isNull = true;
+            pos += 4;
+        } else {
+            char* end = nullptr;
+            number = strtoll(line.c_str() + pos, &end, 10);
+            if (end == line.c_str() + pos) break;
+            pos = end - line.c_str();
+            isNumber = true;
+        }
+        skipSpace();
+
+        if (key == "id" || key == "roomNumber") {
+            if (!isNumber || number < INT_MIN || number > INT_MAX) {
+                error = "Expected an integer for " + key;
+                return false;
+            }
+            (key == "id" ? id : room) = static_cast<int>(number);
+        } else if (isNumber) {
+            error = "Expected a string for " + key;
+            return false;
+        } else if (key == "name") {
+            name = text;
+        } else if (key == "medicalHistory") {
+            history = text;
+        } else if (key == "department") {
+            department = text;
+        } else if (key == "condition") {
+            condition = text;
+        } else if (key == "admissionDate") {
+            admission = isNull ? "" : text;
+        } else if (key == "dischargeDate") {
+            discharge = isNull ? "" : text;
+        }
+    }
+    if (pos >= line.size() || line[pos] != '}') {
+        error = "Malformed JSON object";
+        return false;
+    }
+
+    Date admissionDate, dischargeDate;
+    if (!Date::parse(StrRef(admission.data(), admission.size()), admissionDate) ||
+        !Date::parse(StrRef(discharge.data(), discharge.size()), dischargeDate)) {
+        error = "Dates must be DD-MM-YYYY";
+        return false;
+    }
+    patient = Patient(id, name, history, department, condition, admissionDate, dischargeDate, room);
+    return true;
+}
+
+class HospitalSystem {
+private:
+    SlotStore<PatientRecord> patients;
+    TextArena patientText;  // names and medical histories of the records in patients
+    CodeDictionaries codes; // departments and conditions of the records in patients
+    string csvFilename;
+    int nextPatientId;
+    MutationJournal journal;
+    bool snapshotFormat;
+    ostream* statusOut;     // load/save progress and I/O errors
+    
+    typedef unordered_map<int, vector<int>> IntIndex;
+    // Indexed by dictionary code; codes with no patients have empty buckets.
+    typedef vector<vector<int>> CodeIndex;
+
+        unordered_map<int, int> idToIndex;  
+    CodeIndex departmentToIndices;
+    CodeIndex conditionToIndices;
+    IntIndex roomToIndices;
+    DateIndex admissionIndex;
+    DateIndex dischargeIndex;
+    RoomOccupancyIndex roomOccupancy;
+    NameIndex nameSearch;
+    PatientColumns columns;
+    CensusTimeline censusTimeline;
+    DashboardCounters dashboard;   // statistics for roomOccupancy.getToday()
+    // Guards everything above; see "Thread-safe API" below.
+    mutable SharedMutex stateLock;
+
+    static void buildIndexMaps(const SlotStore<PatientRecord>& records, const CodeDictionaries& codes,
+                               unordered_map<int, int>& ids, CodeIndex& departments,
+                               CodeIndex& conditions, IntIndex& rooms) {
+        ids.clear();
+        departments.assign(codes.departments.size(), vector<int>());
+        conditions.assign(codes.conditions.size(), vector<int>());
+        rooms.clear();
+        
+        for (int i = 0; i < records.slotCount(); i++) {
+            if (!records.isLive(i)) continue;
+            ids[records[i].id] = i;
+            departments[records[i].departmentCode].push_back(i);
+            conditions[records[i].conditionCode].push_back(i);
+            rooms[records[i].roomNumber].push_back(i);
+        }
+    }
+
+    // Posting lists are kept sorted so a delta produces the same bucket a
+    // full rebuild would.
+    template <typename Map, typename Key>
+    static void addToBucket(Map& index, const Key& key, int idx) {
+        vector<int>& bucket = index[key];
+        bucket.insert(lower_bound(bucket.begin(), bucket.end(), idx), idx);
+    }
+
+    static void addToBucket(CodeIndex& index, uint32_t code, int idx) {
+        if (code >= index.size()) {
+            index.resize(code + 1);
+        }
+        vector<int>& bucket = index[code];
+        bucket.insert(lower_bound(bucket.begin(), bucket.end(), idx), idx);
+    }
+
+    static void removeFromBucket(CodeIndex& index, uint32_t code, int idx) {
+        if (code >= index.size()) {
+            return;
+        }
+        vector<int>& bucket = index[code];
+        auto pos = lower_bound(bucket.begin(), bucket.end(), idx);
+        if (pos != bucket.end() && *pos == idx) {
+            bucket.erase(pos);
+        }
+    }
+
+    template <typename Map, typename Key>
+    static void removeFromBucket(Map& index, const Key& key, int idx) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return;
+        }
+        vector<int>& bucket = it->second;
+        auto pos = lower_bound(bucket.begin(), bucket.end(), idx);
+        if (pos != bucket.end() && *pos == idx) {
+            bucket.erase(pos);
+        }
+        if (bucket.empty()) {
+            index.erase(it);
+        }
+    }
+
+    // Keys are compared through the map's own equality, since
+    // unordered_map::operator== compares spellings case-sensitively.
+    template <typename Map>
+    static bool sameIndex(const Map& left, const Map& right) {
+        if (left.size() != right.size()) {
+            return false;
+        }
+        for (const auto& entry : left) {
+            auto it = right.find(entry.first);
+            if (it == right.end() || it->second != entry.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool sameIndex(const CodeIndex& left, const CodeIndex& right) {
+        static const vector<int> empty;
+        for (size_t code = 0; code < max(left.size(), right.size()); code++) {
+            const vector<int>& a = code < left.size() ? left[code] : empty;
+            const vector<int>& b = code < right.size() ? right[code] : empty;
+            if (a != b) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Delta maintenance: each mutation touches only the buckets of the
+    // records it changes instead of calling buildIndices().
+    void indexPatient(int idx) {
+        const PatientRecord& patient = patients[idx];
+        idToIndex[patient.id] = idx;
+        addToBucket(departmentToIndices, patient.departmentCode, idx);
+        addToBucket(conditionToIndices, patient.conditionCode, idx);
+        addToBucket(roomToIndices, patient.roomNumber, idx);
+        admissionIndex.insert(patient.admissionDate, idx);
+        dischargeIndex.insert(patient.dischargeDate, idx);
+        roomOccupancy.insert(patient.roomNumber, patient.admissionDate, patient.dischargeDate, idx);
+        nameSearch.insert(idx, patient.name);
+        columns.set(idx, patient);
+        censusTimeline.insert(patient.admissionDate, patient.dischargeDate, patient.departmentCode);
+        dashboard.insert(patient);
+        nextPatientId = max(nextPatientId, patient.id + 1);
+    }
+
+    // Indexes freshly inserted slots together: the sorted date and room
+    // indices take one merge each instead of one shifted insert per record.
+    // Batches at least half the size of the table are cheaper to rebuild.
+    void indexBatch(const vector<int>& slots) {
+        if (slots.size() * 2 >= patients.size()) {
+            int keepNextId = nextPatientId;
+            buildIndices();
+            nextPatientId = max(nextPatientId, keepNextId);
+            return;
+        }
+        vector<pair<Date, int>> admissions, discharges;
+        vector<RoomOccupancyIndex::StayRecord> stays;
+        vector<pair<int, StrRef>> names;
+        names.reserve(slots.size());
+        admissions.reserve(slots.size());
+        discharges.reserve(slots.size());
+        stays.reserve(slots.size());
+        for (int idx : slots) {
+            const PatientRecord& patient = patients[idx];
+            idToIndex[patient.id] = idx;
+            addToBucket(departmentToIndices, patient.departmentCode, idx);
+            addToBucket(conditionToIndices, patient.conditionCode, idx);
+            addToBucket(roomToIndices, patient.roomNumber, idx);
+            names.push_back(make_pair(idx, patient.name));
+            columns.set(idx, patient);
+            censusTimeline.insert(patient.admissionDate, patient.dischargeDate, patient.departmentCode);
+            dashboard.insert(patient);
+            admissions.push_back(make_pair(patient.admissionDate, idx));
+            discharges.push_back(make_pair(patient.dischargeDate, idx));
+            RoomOccupancyIndex::StayRecord stay = {patient.roomNumber, patient.admissionDate,
+                                                   patient.dischargeDate, idx};
+            stays.push_back(stay);
+            nextPatientId = max(nextPatientId, patient.id + 1);
+        }
+        admissionIndex.insertBatch(admissions);
+        dischargeIndex.insertBatch(discharges);
+        roomOccupancy.insertBatch(stays);
+        nameSearch.insertBatch(names);
+    }
+
+    void unindexPatient(int idx, const PatientRecord& patient) {
+        auto it = idToIndex.find(patient.id);
+        if (it != idToIndex.end() && it->second == idx) {
+            idToIndex.erase(it);
+        }
+        removeFromBucket(departmentToIndices, patient.departmentCode, idx);
+        removeFromBucket(conditionToIndices, patient.conditionCode, idx);
+        removeFromBucket(roomToIndices, patient.roomNumber, idx);
+        admissionIndex.erase(patient.admissionDate, idx);
+        dischargeIndex.erase(patient.dischargeDate, idx);
+        roomOccupancy.erase(patient.roomNumber, patient.admissionDate, patient.dischargeDate, idx);
+        nameSearch.erase(idx);
+        columns.erase(idx);
+        censusTimeline.erase(patient.admissionDate, patient.dischargeDate, patient.departmentCode);
+        dashboard.erase(patient);
+    }
+
+    void reindexPatient(int idx, const PatientRecord& before) {
+        const PatientRecord& after = patients[idx];
+        if (!CaseInsensitiveEqual()(before.name.str(), after.name.str())) {
+            nameSearch.erase(idx);
+            nameSearch.insert(idx, after.name);
+        }
+        if (before.departmentCode != after.departmentCode) {
+            removeFromBucket(departmentToIndices, before.departmentCode, idx);
+            addToBucket(departmentToIndices, after.departmentCode, idx);
+        }
+        if (before.conditionCode != after.conditionCode) {
+            removeFromBucket(conditionToIndices, before.conditionCode, idx);
+            addToBucket(conditionToIndices, after.conditionCode, idx);
+        }
+        if (before.roomNumber != after.roomNumber) {
+            removeFromBucket(roomToIndices, before.roomNumber, idx);
+            addToBucket(roomToIndices, after.roomNumber, idx);
+        }
+        if (!(before.admissionDate == after.admissionDate)) {
+            admissionIndex.erase(before.admissionDate, idx);
+            admissionIndex.insert(after.admissionDate, idx);
+        }
+        if (!(before.dischargeDate == after.dischargeDate)) {
+            dischargeIndex.erase(before.dischargeDate, idx);
+            dischargeIndex.insert(after.dischargeDate, idx);
+        }
+        if (before.roomNumber != after.roomNumber || !(before.admissionDate == after.admissionDate) ||
+            !(before.dischargeDate == after.dischargeDate)) {
+            roomOccupancy.erase(before.roomNumber, before.admissionDate, before.dischargeDate, idx);
+            roomOccupancy.insert(after.roomNumber, after.admissionDate, after.dischargeDate, idx);
+        }
+        if (before.departmentCode != after.departmentCode || !(before.admissionDate == after.admissionDate) ||
+            !(before.dischargeDate == after.dischargeDate)) {
+            censusTimeline.erase(before.admissionDate, before.dischargeDate, before.departmentCode);
+            censusTimeline.insert(after.admissionDate, after.dischargeDate, after.departmentCode);
+        }
+        dashboard.erase(before);
+        dashboard.insert(after);
+        columns.set(idx, after);
+    }
+
+    // Overwrites the record at idx; the old text goes back to the arena once
+    // its index entries are gone.
+    void replacePatientAt(int idx, const Patient& patient) {
+        PatientRecord before = patients[idx];
+        patients[idx] = PatientRecord(patient, patientText, codes);
+        reindexPatient(idx, before);
+        before.releaseText(patientText);
+    }
+
+    // Deletes leave a tombstone, so only the removed record's buckets
+    // change. Once tombstones outnumber live records the store is compacted
+    // and the indices rebuilt, which keeps deletes amortised O(1).
+    void removePatientAt(int idx) {
+        unindexPatient(idx, patients[idx]);
+        patients[idx].releaseText(patientText);
+        patients.erase(idx);
+        if (patients.tombstones() > max<size_t>(1024, patients.size())) {
+            compactStorage();
+        }
+    }
+
+    // Also rewrites the text arena, which drops the free lists and any long
+    // text that editing left behind.
+    void compactStorage() {
+        int keepNextId = nextPatientId;
+        patients.compact();
+        TextArena packed;
+        for (int i = 0; i < patients.slotCount(); i++) {
+            if (patients.isLive(i)) {
+                patients[i].name = packed.store(patients[i].name);
+                patients[i].medicalHistory = packed.store(patients[i].medicalHistory);
+            }
+        }
+        patientText.swap(packed);
+        buildIndices();
+        nextPatientId = max(nextPatientId, keepNextId);
+    }
+
+    void verifyIndicesAfterMutation() const {
+#ifdef HMS_VERIFY_INDICES
+        if (!checkIndexConsistency()) {
+            throw logic_error("Incremental index diverged from full rebuild");
+        }
+#endif
+    }
+
+    // Menu listings page at about one screen when a person is at the
+    // console; Enter shows the next page and q returns to the menu.
+    static const size_t consolePageLines = 50;
+
+    // pendingNewline: the listing follows a cin >> value, whose newline is
+    // still unread and must not count as the first Enter.
+    static void attachConsolePager(RecordWriter& writer, bool pendingNewline) {
+        if (!interactiveConsole()) {
+            return;
+        }
+        writer.setPager(consolePageLines, [pendingNewline]() mutable {
+            if (pendingNewline) {
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                pendingNewline = false;
+            }
+            cout << "-- Enter for more, q to stop -- " << flush;
+            string answer;
+            return getline(cin, answer) && answer != "q" && answer != "Q";
+        });
+    }
+
+    template <typename Slots>
+    void listRecords(const Slots& slots, bool pendingNewline = false) const {
+        RecordWriter writer(cout, OutputRecord);
+        attachConsolePager(writer, pendingNewline);
+        for (int idx : slots) {
+            if (!writer.write(patients[idx])) {
+                break;
+            }
+        }
+    }
+
+public:
+        int getPatientCount() const {
+        return patients.size();
+    }
+
+    int getAvailableRooms() const {
+        return 200 - roomOccupancy.occupiedRoomsToday();
+    }
+
+    int getOccupiedRooms() const {
+        return roomOccupancy.occupiedRoomsToday();
+    }
+
+    void buildIndices() {
+        HMS_PERF_SCOPE(PerfBuildIndices);
+        buildIndexMaps(patients, codes, idToIndex, departmentToIndices,
+                       conditionToIndices, roomToIndices);
+        buildDateIndex(admissionIndex, &PatientRecord::admissionDate);
+        buildDateIndex(dischargeIndex, &PatientRecord::dischargeDate);
+        buildRoomOccupancy(roomOccupancy);
+        buildNameSearch(nameSearch);
+        buildColumns(columns);
+        censusTimeline.build(columns);
+        dashboard.reset(computeStatistics(columns, roomOccupancy.getToday(), 200, sharedWorkerPool()),
+                        roomOccupancy.getToday(), 200);
+        
+        nextPatientId = 1;
+        for (const auto& patient : patients) {
+            nextPatientId = max(nextPatientId, patient.id + 1);
+        }
+    }
+
+    void buildDateIndex(DateIndex& index, Date PatientRecord::*column) const {
+        vector<pair<Date, int>> dates;
+        dates.reserve(patients.size());
+        for (int i = 0; i < patients.slotCount(); i++) {
+            if (patients.isLive(i)) {
+                dates.push_back(make_pair(patients[i].*column, i));
+            }
+        }
+        index.build(dates);
+    }
+
+    void buildRoomOccupancy(RoomOccupancyIndex& index) const {
+        index.clear();
+        vector<RoomOccupancyIndex::StayRecord> stays;
+        stays.reserve(patients.size());
+        for (int i = 0; i < patients.slotCount(); i++) {
+            if (patients.isLive(i)) {
+                RoomOccupancyIndex::StayRecord stay = {patients[i].roomNumber, patients[i].admissionDate,
+                                                       patients[i].dischargeDate, i};
+                stays.push_back(stay);
+            }
+        }
+        index.insertBatch(stays);
+    }
+
+    void buildNameSearch(NameIndex& index) const {
+        vector<pair<int, StrRef>> names;
+        names.reserve(patients.size());
+        for (int i = 0; i < patients.slotCount(); i++) {
+            if (patients.isLive(i)) {
+                names.push_back(make_pair(i, patients[i].name));
+            }
+        }
+        index.clear();
+        index.insertBatch(names);
+    }
+
+    void buildColumns(PatientColumns& target) const {
+        target.clear();
+        for (int i = 0; i < patients.slotCount(); i++) {
+            if (patients.isLive(i)) {
+                target.set(i, patients[i]);
+            }
+        }
+    }
+
+    // STATS and CENSUS answer "who is in hospital on day" from different
+    // structures (a scan or the dashboard; the timeline and the room index),
+    // so they must give the same counts.
+    bool censusAgrees(const StatisticsReport& report, const Date& day) const {
+        const CensusCounts& census = report.census;
+        if (static_cast<long long>(census.admitted) != censusTimeline.activeOn(day)) {
+            return false;
+        }
+        size_t codes = max(census.departmentAdmitted.size(), censusTimeline.departmentCount());
+        for (size_t code = 0; code < codes; code++) {
+            long long counted = code < census.departmentAdmitted.size() ? census.departmentAdmitted[code] : 0;
+            if (counted != censusTimeline.activeOn(day, static_cast<uint32_t>(code))) {
+                return false;
+            }
+        }
+        for (int room = 1; room < static_cast<int>(census.roomOccupants.size()); room++) {
+            if (census.roomOccupants[room] != roomOccupancy.occupantsOn(room, day)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Rebuilds every index from scratch and compares it with the incrementally
+    // maintained one. Used to fuzz the delta path; prints the first mismatch.
+    bool checkIndexConsistency() const {
+        unordered_map<int, int> freshIds;
+        CodeIndex freshDepartments, freshConditions;
+        IntIndex freshRooms;
+        buildIndexMaps(patients, codes, freshIds, freshDepartments,
+                       freshConditions, freshRooms);
+
+        if (!sameIndex(freshIds, idToIndex)) {
+            cerr << "Index mismatch: idToIndex" << endl;
+            return false;
+        }
+        if (!sameIndex(freshDepartments, departmentToIndices)) {
+            cerr << "Index mismatch: departmentToIndices" << endl;
+            return false;
+        }
+        if (!sameIndex(freshConditions, conditionToIndices)) {
+            cerr << "Index mismatch: conditionToIndices" << endl;
+            return false;
+        }
+        if (!sameIndex(freshRooms, roomToIndices)) {
+            cerr << "Index mismatch: roomToIndices" << endl;
+            return false;
+        }
+        DateIndex freshAdmissions, freshDischarges;
+        buildDateIndex(freshAdmissions, &PatientRecord::admissionDate);
+        buildDateIndex(freshDischarges, &PatientRecord::dischargeDate);
+        if (freshAdmissions != admissionIndex) {
+            cerr << "Index mismatch: admissionIndex" << endl;
+            return false;
+        }
+        if (freshDischarges != dischargeIndex) {
+            cerr << "Index mismatch: dischargeIndex" << endl;
+            return false;
+        }
+        RoomOccupancyIndex freshOccupancy;
+        freshOccupancy.setToday(roomOccupancy.getToday());
+        buildRoomOccupancy(freshOccupancy);
+        if (freshOccupancy != roomOccupancy) {
+            cerr << "Index mismatch: roomOccupancy" << endl;
+            return false;
+        }
+        NameIndex freshNameSearch;
+        buildNameSearch(freshNameSearch);
+        if (freshNameSearch != nameSearch) {
+            cerr << "Index mismatch: nameSearch" << endl;
+            return false;
+        }
+        PatientColumns freshColumns;
+        buildColumns(freshColumns);
+        if (freshColumns != columns) {
+            cerr << "Index mismatch: columns" << endl;
+            return false;
+        }
+        CensusTimeline freshTimeline;
+        freshTimeline.build(freshColumns);
+        if (freshTimeline != censusTimeline) {
+            cerr << "Index mismatch: censusTimeline" << endl;
+            return false;
+        }
+        if (!(dashboard.getDay() == roomOccupancy.getToday()) ||
+            !dashboard.matches(computeStatistics(freshColumns, dashboard.getDay(), 200, sharedWorkerPool()))) {
+            cerr << "Index mismatch: dashboard" << endl;
+            return false;
+        }
+        if (!censusAgrees(dashboard.view(), dashboard.getDay())) {
+            cerr << "Index mismatch: dashboard census vs timeline and room index" << endl;
+            return false;
+        }
+        for (const auto& patient : patients) {
+            if (patient.id >= nextPatientId) {
+                cerr << "Index mismatch: nextPatientId " << nextPatientId
+                     << " not above patient ID " << patient.id << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Status lines (records loaded, saved, journal errors) go to status, so
+    // scripted callers can keep stdout for results.
+    HospitalSystem(const string& filename, ostream& status = cout)
+        : csvFilename(filename), nextPatientId(1), snapshotFormat(false), statusOut(&status) {
+        if (!loadFromCSV(csvFilename)) {
+            throw runtime_error("Error: Could not open file " + filename + ". Please check if the file exists and try again.");
+        }
+    }
+
+    ~HospitalSystem() {
+        if (journal.recordCount() > 0) {
+            saveToCSV();
+        }
+    }
+
+    enum RecordStatus { RecordSkipped, RecordParsed, RecordInvalid };
+
+    // Splits and checks one CSV line without intermediate strings. Comment
+    // lines and lines that do not have exactly eight fields are skipped, as
+    // before.
+    struct RecordFields {
+        StrRef text[8];
+        int id;
+        int room;
+        Date admission;
+        Date discharge;
+    };
+
+    static RecordStatus splitRecord(StrRef line, RecordFields& record) {
+        if (line.size >= 2 && line.data[0] == '/' && line.data[1] == '/') {
+            return RecordSkipped;
+        }
+        // getline-based splitting never produced a trailing empty field
+        size_t length = line.size;
+        if (length > 0 && line.data[length - 1] == ',') {
+            length--;
+        }
+        if (length == 0) {
+            return RecordSkipped;
+        }
+
+        StrRef* fields = record.text;
+        size_t count = 0;
+        size_t start = 0;
+        for (size_t i = 0; i <= length; i++) {
+            if (i == length || line.data[i] == ',') {
+                if (count == 8) {
+                    return RecordSkipped;
+                }
+                fields[count++] = StrRef(line.data + start, i - start);
+                start = i + 1;
+            }
+        }
+        if (count != 8) {
+            return RecordSkipped;
+        }
+
+        if (!parseInt(fields[0], record.id) || !parseInt(fields[7], record.room) ||
+            !Date::parse(fields[5], record.admission) || !Date::parse(fields[6], record.discharge)) {
+            return RecordInvalid;
+        }
+        return RecordParsed;
+    }
+
+    static RecordStatus parseRecord(StrRef line, vector<Patient>& out) {
+        RecordFields fields;
+        RecordStatus status = splitRecord(line, fields);
+        if (status == RecordParsed) {
+            out.emplace_back(fields.id, fields.text[1].str(), fields.text[2].str(), fields.text[3].str(),
+                             fields.text[4].str(), fields.admission, fields.discharge, fields.room);
+        }
+        return status;
+    }
+
+    // Loader form: the text goes straight from the file into an arena.
+    static RecordStatus parseRecord(StrRef line, vector<PatientRecord>& out, TextArena& text,
+                                    CodeCache& cache) {
+        RecordFields fields;
+        RecordStatus status = splitRecord(line, fields);
+        if (status == RecordParsed) {
+            PatientRecord record;
+            record.id = fields.id;
+            record.name = text.store(fields.text[1]);
+            record.medicalHistory = text.store(fields.text[2]);
+            record.departmentCode = cache.departments.intern(fields.text[3]);
+            record.conditionCode = cache.conditions.intern(fields.text[4]);
+            record.admissionDate = fields.admission;
+            record.dischargeDate = fields.discharge;
+            record.roomNumber = fields.room;
+            record.dictionaries = &cache.codes;
+            out.push_back(record);
+        }
+        return status;
+    }
+
+    struct LoadChunk {
+        const char* begin;
+        const char* end;
+        vector<PatientRecord> records;
+        TextArena text;
+        CodeDictionaries* codes;
+        vector<string> errors;
+    };
+
+    static void parseChunk(LoadChunk& chunk) {
+        CodeCache cache(*chunk.codes);
+        const char* cursor = chunk.begin;
+        while (cursor < chunk.end) {
+            const char* newline = static_cast<const char*>(memchr(cursor, '\n', chunk.end - cursor));
+            const char* lineEnd = newline ? newline : chunk.end;
+            StrRef line(cursor, lineEnd - cursor);
+            if (line.size > 0 && line.data[line.size - 1] == '\r') {
+                line.size--;
+            }
+            if (parseRecord(line, chunk.records, chunk.text, cache) == RecordInvalid) {
+                chunk.errors.push_back(line.str());
+            }
+            cursor = lineEnd + 1;
+        }
+    }
+
+    // Memory-maps the file and parses line-aligned chunks on all cores.
+    // Chunks are merged in file order so record order and the order of
+    // "Error parsing line" diagnostics match a sequential read.
+    bool loadFromCSV(const string& filename) {
+        HMS_PERF_SCOPE(PerfLoad);
+        snapshotFormat = SnapshotReader::isSnapshot(filename);
+        if (snapshotFormat) {
+            return loadFromSnapshot(filename);
+        }
+        MappedFile file;
+        if (!file.open(filename)) {
+            return false;
+        }
+
+        const size_t minChunkBytes = 1 << 20;
+        size_t workers = max(1u, thread::hardware_concurrency());
+        workers = max<size_t>(1, min(workers, file.size() / minChunkBytes));
+
+        vector<LoadChunk> chunks(workers);
+        const char* data = file.data();
+        const char* end = data + file.size();
+        const char* cursor = data;
+        for (size_t i = 0; i < workers; i++) {
+            const char* chunkEnd = end;
+            if (i + 1 < workers) {
+                chunkEnd = max(cursor, data + file.size() / workers * (i + 1));
+                const char* newline = static_cast<const char*>(memchr(chunkEnd, '\n', end - chunkEnd));
+                chunkEnd = newline ? newline + 1 : end;
+            }
+            chunks[i].begin = cursor;
+            chunks[i].end = chunkEnd;
+            chunks[i].codes = &codes;
+            cursor = chunkEnd;
+        }
+
+        if (workers == 1) {
+            parseChunk(chunks[0]);
+        } else {
+            vector<thread> threads;
+            for (size_t i = 0; i < workers; i++) {
+                threads.emplace_back(parseChunk, ref(chunks[i]));
+            }
+            for (auto& worker : threads) {
+                worker.join();
+            }
+        }
+
+        size_t total = 0;
+        for (const auto& chunk : chunks) {
+            total += chunk.records.size();
+        }
+        patients.clear();
+        patientText.clear();
+        patients.reserve(total);
+        for (auto& chunk : chunks) {
+            for (const auto& line : chunk.errors) {
+                cerr << "Error parsing line: " << line << endl;
+            }
+            for (const auto& record : chunk.records) {
+                patients.push_back(record);
+            }
+            vector<PatientRecord>().swap(chunk.records);
+            patientText.adopt(chunk.text);
+        }
+        file.close();
+
+        finishLoad(filename);
+        return true;
+    }
+
+    bool loadFromSnapshot(const string& filename) {
+        SnapshotReader reader;
+        if (!reader.open(filename)) {
+            cerr << "Error reading snapshot " << filename << ": " << reader.lastError() << endl;
+            return false;
+        }
+        patients.clear();
+        patientText.clear();
+        patients.reserve(reader.rowCount());
+        CodeCache cache(codes);
+        for (uint32_t row = 0; row < reader.rowCount(); row++) {
+            patients.push_back(reader.materialize(row, patientText, cache));
+        }
+        finishLoad(filename);
+        return true;
+    }
+
+    // Load time is recorded under PerfLoad; the bench suite reports rows/sec.
+    void finishLoad(const string& filename) {
+        buildIndices();
+        
+        *statusOut << "Loaded " << patients.size() << " patient records from " << filename << endl;
+
+        size_t replayed = replayJournal(journalPathFor(filename));
+        if (replayed > 0) {
+            *statusOut << "Replayed " << replayed << " journal records" << endl;
+        }
+        journal.open(journalPathFor(filename), replayed);
+    }
+
+    static string journalPathFor(const string& filename) {
+        return filename + ".journal";
+    }
+
+    // Re-applies journal records on top of the loaded snapshot. Records are
+    // idempotent, so a journal that survived a crash during compaction can be
+    // replayed over the new snapshot safely. A torn final line is ignored.
+    size_t replayJournal(const string& path) {
+        ifstream file(path);
+        if (!file) {
+            return 0;
+        }
+
+        size_t applied = 0;
+        string line;
+        vector<Patient> parsed;
+        while (getline(file, line)) {
+            if (line.size() < 2 || line[1] != ',') {
+                continue;
+            }
+            StrRef payload(line.data() + 2, line.size() - 2);
+            int id;
+            parsed.clear();
+            if (line[0] == 'D' && parseInt(payload, id)) {
+                applyDelete(id);
+            } else if ((line[0] == 'A' || line[0] == 'U') &&
+                       parseRecord(payload, parsed) == RecordParsed) {
+                applyUpsert(parsed[0]);
+            } else {
+                cerr << "Error replaying journal record: " << line << endl;
+                continue;
+            }
+            applied++;
+        }
+        return applied;
+    }
+
+    // Core mutations shared by the interactive commands and journal replay.
+    void applyUpsert(const Patient& patient) {
+        HMS_PERF_SCOPE(idToIndex.count(patient.id) ? PerfUpdate : PerfAdd);
+        auto it = idToIndex.find(patient.id);
+        if (it == idToIndex.end()) {
+            indexPatient(patients.insert(PatientRecord(patient, patientText, codes)));
+        } else {
+            replacePatientAt(it->second, patient);
+        }
+        verifyIndicesAfterMutation();
+    }
+
+    bool applyDelete(int id) {
+        HMS_PERF_SCOPE(PerfDelete);
+        auto it = idToIndex.find(id);
+        if (it == idToIndex.end()) {
+            return false;
+        }
+        removePatientAt(it->second);
+        verifyIndicesAfterMutation();
+        return true;
+    }
+
+    // Records a mutation in the journal; the snapshot is only rewritten once
+    // the journal grows past the size of the table, keeping writes amortised
+    // O(1) per edit.
+    void persist(char op, const string& payload) {
+        HMS_PERF_SCOPE(PerfJournal);
+        if (!journal.append(op, payload)) {
+            *statusOut << "Error: Cannot append to journal " << journal.getPath()
+                 << ", writing full snapshot instead" << endl;
+            saveToCSV();
+            return;
+        }
+        if (journal.recordCount() >= max<size_t>(1024, patients.size())) {
+            saveToCSV();
+        }
+    }
+
+    // Journals a batch with a single write and fsync.
+    void persistBatch(char op, const vector<string>& payloads) {
+        HMS_PERF_SCOPE(PerfJournal);
+        if (payloads.empty()) {
+            return;
+        }
+        if (!journal.appendBatch(op, payloads)) {
+            *statusOut << "Error: Cannot append to journal " << journal.getPath()
+                 << ", writing full snapshot instead" << endl;
+            saveToCSV();
+            return;
+        }
+        if (journal.recordCount() >= max<size_t>(1024, patients.size())) {
+            saveToCSV();
+        }
+    }
+
+    bool writeCSV(const string& path) const {
+        AtomicFile file(path);
+        if (!file.isOpen()) {
+            return false;
+        }
+        string buffer = "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+        for (const auto& patient : patients) {
+            patient.appendCSV(buffer);
+            buffer += '\n';
+            if (buffer.size() >= (1 << 16)) {
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), buffer.size());
+        return file.commit();
+    }
+
+    bool writeSnapshot(const string& path) const {
+        return SnapshotWriter::write(path, patients);
+    }
+
+    // Folds the journal into a new snapshot in the format the data was
+    // loaded from. The file is replaced atomically, so a crash mid-write
+    // never leaves a truncated file, and the journal is emptied afterwards.
+    void saveToCSV() {
+        HMS_PERF_SCOPE(PerfSave);
+        bool ok = snapshotFormat ? writeSnapshot(csvFilename) : writeCSV(csvFilename);
+        if (!ok) {
+            *statusOut << "Error: Cannot write file: " << csvFilename << endl;
+            return;
+        }
+        journal.reset();
+        
+        *statusOut << "Saved " << patients.size() << " patient records to " << csvFilename << endl;
+    }
+
+    bool isRoomAvailable(int roomNumber) const {
+        return isRoomAvailable(roomNumber, roomOccupancy.getToday());
+    }
+
+    bool isRoomAvailable(int roomNumber, const Date& day) const {
+        if (roomNumber < 1 || roomNumber > 200) {
+            throw invalid_argument("Room number must be between 1 and 200");
+        }
+        return roomOccupancy.isFreeOn(roomNumber, day);
+    }
+
+    // Rooms with no stay overlapping [from, until); unset until = open-ended.
+    vector<int> getRoomsFreeFor(const Date& from, const Date& until) const {
+        vector<int> free;
+        for (int room = 1; room <= 200; room++) {
+            if (roomOccupancy.isFreeFor(room, from, until)) {
+                free.push_back(room);
+            }
+        }
+        return free;
+    }
+
+    // Pairs of record indices whose stays share a room on some day.
+    vector<pair<int, int>> getOverbookedStays() const {
+        return roomOccupancy.overlappingStays();
+    }
+
+    // Thread-safe API
+    //
+    // All of the state above is guarded by stateLock, a single reader-writer
+    // lock. Every mutation updates the record and all of its indices
+    // together, so per-index locks would only add lock-ordering rules without
+    // letting more readers in. The methods in this section take the lock
+    // shared (lookups, queries, statistics) or exclusive (admit, update,
+    // remove, journal writes) and return copies of records rather than slot
+    // numbers, since slots can be reused or compacted once the lock is
+    // released. Readers run in parallel with each other and wait only for
+    // the short exclusive section of a write, never for its input handling.
+    //
+    // Everything else, including the interactive menu commands, assumes the
+    // caller owns the system exclusively (the console thread in menu mode).
+    bool getPatient(int id, Patient& out) const {
+        HMS_PERF_SCOPE(PerfLookupId);
+        ReadLock guard(stateLock);
+        auto it = idToIndex.find(id);
+        if (it == idToIndex.end()) {
+            return false;
+        }
+        out = patients[it->second].toPatient();
+        return true;
+    }
+
+    vector<Patient> queryPatients(const PatientQuery& query, size_t limit = SIZE_MAX) const {
+        ReadLock guard(stateLock);
+        vector<int> matches = runQuery(query);
+        vector<Patient> result;
+        result.reserve(min(limit, matches.size()));
+        for (size_t i = 0; i < matches.size() && i < limit; i++) {
+            result.push_back(patients[matches[i]].toPatient());
+        }
+        return result;
+    }
+
+    // Streams the matches without holding the read lock while writing: the
+    // query collects the matching ids under the lock, then each batch of
+    // streamBatch rows is copied out under the lock again and written after
+    // releasing it, so a slow reader (a pager, a full pipe) never stalls
+    // writers. Records removed in the meantime are skipped; records edited
+    // in the meantime are written as they are now.
+    static const size_t streamBatch = 1024;
+
+    size_t writeQueryResults(const PatientQuery& query, RecordWriter& writer) const {
+        vector<int> ids;
+        {
+            ReadLock guard(stateLock);
+            vector<int> matches = runQuery(query);
+            ids.reserve(matches.size());
+            for (int idx : matches) {
+                ids.push_back(patients[idx].id);
+            }
+        }
+        vector<Patient> batch;
+        for (size_t first = 0; first < ids.size(); first += streamBatch) {
+            batch.clear();
+            {
+                ReadLock guard(stateLock);
+                for (size_t i = first; i < ids.size() && i < first + streamBatch; i++) {
+                    auto it = idToIndex.find(ids[i]);
+                    if (it != idToIndex.end()) {
+                        batch.push_back(patients[it->second].toPatient());
+                    }
+                }
+            }
+            for (const Patient& patient : batch) {
+                if (!writer.write(patient)) {
+                    writer.flush();
+                    return writer.rowsWritten();
+                }
+            }
+        }
+        writer.flush();
+        return writer.rowsWritten();
+    }
+
+    size_t patientCount() const {
+        ReadLock guard(stateLock);
+        return patients.size();
+    }
+
+    // Names for the codes in StatisticsReport and DayCensus. The
+    // dictionaries only grow, so no state lock is needed.
+    const string& departmentName(uint32_t code) const {
+        return codes.departments.value(code);
+    }
+
+    const string& conditionName(uint32_t code) const {
+        return codes.conditions.value(code);
+    }
+
+    // The current day is served from the dashboard counters; other days
+    // take a full pass over the columns.
+    StatisticsReport statisticsOn(const Date& day) const {
+        ReadLock guard(stateLock);
+        if (day == dashboard.getDay()) {
+            return dashboard.view();
+        }
+        return computeStatistics(columns, day, 200, sharedWorkerPool());
+    }
+
+    // Point-in-time census from the timeline; O(log days) per count, plus
+    // one O(log stays) probe of the room index per room.
+    DayCensus censusOn(const Date& day) const {
+        ReadLock guard(stateLock);
+        DayCensus census;
+        census.day = day;
+        census.patients = censusTimeline.activeOn(day);
+        census.departments.resize(censusTimeline.departmentCount());
+        for (size_t code = 0; code < census.departments.size(); code++) {
+            census.departments[code] = censusTimeline.activeOn(day, static_cast<uint32_t>(code));
+        }
+        for (int room = 1; room <= 200; room++) {
+            census.occupiedRooms += !roomOccupancy.isFreeOn(room, day);
+        }
+        return census;
+    }
+
+    OccupancySeries occupancyBetween(const Date& from, const Date& to) const {
+        ReadLock guard(stateLock);
+        return occupancySeries(columns, from, to, 200);
+    }
+
+    // First admission to last admission or discharge on record; both
+    // invalid when there are no admissions.
+    void historySpan(Date& from, Date& to) const {
+        ReadLock guard(stateLock);
+        from = admissionIndex.first();
+        to = admissionIndex.last();
+        if (to < dischargeIndex.last()) to = dischargeIndex.last();
+    }
+
+    void stayAnalyticsBetween(const Date& from, const Date& to, int periodDays, StayAnalytics& analytics) const {
+        ReadLock guard(stateLock);
+        analyzeStays(columns, from, to, periodDays, 200, sharedWorkerPool(), analytics);
+    }
+
+    bool verifyIndices() const {
+        ReadLock guard(stateLock);
+        return checkIndexConsistency();
+    }
+
+    // Adds a new record; an id of 0 assigns the next free id. Returns the
+    // id, or -1 with error set if the record fails validation.
+    int admitPatient(Patient patient, string& error) {
+        lock_guard<SharedMutex> guard(stateLock);
+        if (patient.id == 0) {
+            patient.id = nextPatientId;
+        }
+        string problem = validationError(patient);
+        if (!problem.empty()) {
+            error = problem;
+            return -1;
+        }
+        applyUpsert(patient);
+        persist('A', patient.toCSV());
+        return patient.id;
+    }
+
+    bool updatePatientRecord(const Patient& patient, string& error) {
+        lock_guard<SharedMutex> guard(stateLock);
+        if (idToIndex.find(patient.id) == idToIndex.end()) {
+            error = "Patient not found.";
+            return false;
+        }
+        string problem = validationError(patient, false);
+        if (!problem.empty()) {
+            error = problem;
+            return false;
+        }
+        applyUpsert(patient);
+        persist('U', patient.toCSV());
+        return true;
+    }
+
+    bool removePatient(int id) {
+        lock_guard<SharedMutex> guard(stateLock);
+        if (!applyDelete(id)) {
+            return false;
+        }
+        persist('D', to_string(id));
+        return true;
+    }
+
+    // Admits a batch of new records. Each row is checked with the
+    // validationError rules (which include the rooms' existing stays) and
+    // against the rows accepted before it; rejected rows are reported and skipped.
+    // Accepted rows are stored, indexed in one merge and journaled with a
+    // single flush. An id of 0 assigns the next free id. rows gives each
+    // record's feed line for the report (defaults to its 1-based position).
+    IngestReport ingestPatients(vector<Patient> batch, const vector<size_t>& rows = vector<size_t>()) {
+        HMS_PERF_SCOPE(PerfIngest);
+        lock_guard<SharedMutex> guard(stateLock);
+        IngestReport report;
+        unordered_set<int> batchIds;
+        unordered_map<int, vector<pair<uint32_t, uint32_t>>> batchStays;
+        vector<Patient> accepted;
+        int nextId = nextPatientId;
+        for (size_t i = 0; i < batch.size(); i++) {
+            Patient& patient = batch[i];
+            size_t row = i < rows.size() ? rows[i] : i + 1;
+            int requestedId = patient.id;
+            if (patient.id == 0) {
+                patient.id = nextId;
+            }
+            string reason = validationError(patient);
+            uint32_t start = patient.admissionDate.packed();
+            uint32_t end = patient.dischargeDate.isValid() ? patient.dischargeDate.packed() : UINT32_MAX;
+            bool claimedId = false;
+            if (reason.empty()) {
+                claimedId = batchIds.insert(patient.id).second;
+                if (!claimedId) {
+                    reason = "Patient ID appears twice in the batch.";
+                }
+            }
+            if (reason.empty()) {
+                bool free = true;
+                for (const auto& stay : batchStays[patient.roomNumber]) {
+                    free = free && !(stay.first < end && start < stay.second);
+                }
+                if (!free) {
+                    reason = "Room " + to_string(patient.roomNumber) + " is occupied during the requested stay.";
+                }
+            }
+            if (!reason.empty()) {
+                if (claimedId) {
+                    batchIds.erase(patient.id);
+                }
+                IngestReject reject = {row, requestedId, reason};
+                report.rejects.push_back(reject);
+                continue;
+            }
+            batchStays[patient.roomNumber].push_back(make_pair(start, end));
+            nextId = max(nextId, patient.id + 1);
+            accepted.push_back(patient);
+        }
+
+        vector<int> slots;
+        vector<string> payloads;
+        slots.reserve(accepted.size());
+        payloads.reserve(accepted.size());
+        for (const Patient& patient : accepted) {
+            slots.push_back(patients.insert(PatientRecord(patient, patientText, codes)));
+            payloads.push_back(patient.toCSV());
+        }
+        indexBatch(slots);
+        verifyIndicesAfterMutation();
+        persistBatch('A', payloads);
+        report.accepted = accepted.size();
+        return report;
+    }
+
+    // Parses a CSV (with or without the header line) or NDJSON feed and
+    // ingests it. Rows that do not parse are reported with the rest.
+    IngestReport ingestStream(istream& in, IngestFormat format) {
+        vector<Patient> batch;
+        vector<size_t> rows;
+        vector<IngestReject> malformed;
+        string line;
+        size_t row = 0;
+        while (getline(in, line)) {
+            row++;
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (line.empty() || (format == IngestCSV && row == 1 && line.compare(0, 3, "ID,") == 0)) {
+                continue;
+            }
+            string error;
+            if (format == IngestNDJSON) {
+                Patient patient;
+                if (parsePatientJson(line, patient, error)) {
+                    batch.push_back(patient);
+                    rows.push_back(row);
+                    continue;
+                }
+            } else {
+                RecordStatus status = parseRecord(StrRef(line.data(), line.size()), batch);
+                if (status == RecordParsed) {
+                    rows.push_back(row);
+                    continue;
+                }
+                if (status == RecordSkipped && line.compare(0, 2, "//") == 0) {
+                    continue;
+                }
+                error = status == RecordSkipped ? "Expected 8 comma-separated fields"
+                                                : "Invalid id, room number or date";
+            }
+            IngestReject reject = {row, 0, error};
+            malformed.push_back(reject);
+        }
+
+        IngestReport report = ingestPatients(batch, rows);
+        report.rejects.insert(report.rejects.end(), malformed.begin(), malformed.end());
+        sort(report.rejects.begin(), report.rejects.end(),
+             [](const IngestReject& left, const IngestReject& right) { return left.row < right.row; });
+        return report;
+    }
+
+    // Records whose stay starts or ends in (earlier day, later day], i.e.
+    // the ones that can be in hospital on one of the days but not the other.
+    vector<int> staysChangingBetween(const Date& from, const Date& to) const {
+        Date low = (from < to ? from : to).addDays(1);
+        Date high = from < to ? to : from;
+        vector<int> changed = admissionIndex.range(low, high);
+        vector<int> discharged = dischargeIndex.range(low, high);
+        changed.insert(changed.end(), discharged.begin(), discharged.end());
+        sort(changed.begin(), changed.end());
+        changed.erase(unique(changed.begin(), changed.end()), changed.end());
+        return changed;
+    }
+
+    // Day-rollover hook for the room index; see RoomOccupancyIndex::setToday.
+    void rollRoomOccupancy(const Date& day) {
+        vector<RoomOccupancyIndex::StayRecord> changed;
+        for (int idx : staysChangingBetween(roomOccupancy.getToday(), day)) {
+            const PatientRecord& record = patients[idx];
+            RoomOccupancyIndex::StayRecord stay = {record.roomNumber, record.admissionDate, record.dischargeDate, idx};
+            changed.push_back(stay);
+        }
+        roomOccupancy.setToday(day, changed);
+    }
+
+    // Day-rollover hook for the dashboard; the same records change sides
+    // as in the room index.
+    void rollDashboard(const Date& day) {
+        Date from = dashboard.getDay();
+        if (day == from) {
+            return;
+        }
+        if (!from.isValid()) {
+            dashboard.reset(computeStatistics(columns, day, 200, sharedWorkerPool()), day, 200);
+            return;
+        }
+        vector<int> changed = staysChangingBetween(from, day);
+        for (int idx : changed) {
+            dashboard.erase(patients[idx]);
+        }
+        dashboard.setDay(day);
+        for (int idx : changed) {
+            dashboard.insert(patients[idx]);
+        }
+    }
+
+    // Moves the cached occupancy and the dashboard to the current date if
+    // the day changed.
+    void refreshDay() {
+        lock_guard<SharedMutex> guard(stateLock);
+        Date today = Date::today();
+        if (!(today == roomOccupancy.getToday())) {
+            rollRoomOccupancy(today);
+            rollDashboard(today);
+        }
+    }
+
+    void addPatient() {
+        string name, medHistory, department, condition;
+        string admissionDateStr, dischargeDateStr;
+        int roomNumber;
+        
+        cin.ignore();
+        
+        system("cls");
+        cout << "\n=== Add New Patient ===\n";
+        cout << "Please fill in the patient information:\n\n";
+        
+        while (true) {
+            cout << "Enter patient name (2-50 characters): ";
+            getline(cin, name);
+            if (name.length() >= 2 && name.length() <= 50) {
+                break;
+            }
+            cout << "Error: Name must be between 2 and 50 characters\n";
+        }
+        
+        while (true) {
+            cout << "Enter medical history (max 200 characters): ";
+            getline(cin, medHistory);
+            if (medHistory.length() <= 200) {
+                break;
+            }
+            cout << "Error: Medical history must be less than 200 characters\n";
+        }
+        
+        cout << "\nAvailable departments:\n";
+        for (size_t code = 0; code < departmentToIndices.size(); code++) {
+            if (!departmentToIndices[code].empty()) {
+                cout << "- " << codes.departments.value(code) << " ("
+                     << departmentToIndices[code].size() << " patients)\n";
+            }
+        }
+        
+        while (true) {
+            cout << "\nEnter department (select from the list above): ";
+            getline(cin, department);
+            
+            uint32_t code;
+            bool isValid = codes.departments.find(department, code) &&
+                           code < departmentToIndices.size() &&
+                           !departmentToIndices[code].empty();
+            
+            if (isValid) {
+                break;
+            }
+            cout << "Error: Invalid department. Please select from the list above.\n";
+        }
+        
+        while (true) {
+            cout << "Enter condition (2-100 characters): ";
+            getline(cin, condition);
+            if (condition.length() >= 2 && condition.length() <= 100) {
+                break;
+            }
+            cout << "Error: Condition must be between 2 and 100 characters\n";
+        }
+        
+        while (true) {
+            cout << "Enter admission date (DD-MM-YYYY): ";
+            getline(cin, admissionDateStr);
+            try {
+                Date admissionDate(admissionDateStr);
+                if (admissionDate < Date()) {
+                    throw invalid_argument("Admission date cannot be in the past");
+                }
+                break;
+            } catch (const invalid_argument& e) {
+                cout << "Error: " << e.what() << "\n";
+            }
+        }
+        
+        while (true) {
+            cout << "Enter discharge date (DD-MM-YYYY, leave empty if not discharged): ";
+            getline(cin, dischargeDateStr);
+            
+            if (dischargeDateStr.empty()) {
+                break;
+            }
+            
+            try {
+                Date admissionDate(admissionDateStr);
+                Date dischargeDate(dischargeDateStr);
+                
+                if (dischargeDate < admissionDate) {
+                    throw invalid_argument("Discharge date cannot be before admission date");
+                }
+                break;
+            } catch (const invalid_argument& e) {
+                cout << "Error: " << e.what() << "\n";
+            }
+        }
+
+        Date requestedAdmission(admissionDateStr);
+        Date requestedDischarge(dischargeDateStr);
+        Date today = roomOccupancy.getToday();
+
+        cout << "\nAvailable Rooms (1-200):\n";
+        for (int i = 1; i <= 200; i++) {
+            int currentPatients = roomOccupancy.occupantsOn(i, today);
+            if (roomOccupancy.isFreeFor(i, requestedAdmission, requestedDischarge)) {
+                cout << "- Room " << i << ": Available (" << currentPatients << " current patients)\n";
+            } else {
+                auto it = roomToIndices.find(i);
+                cout << "- Room " << i << ": Occupied (" 
+                     << currentPatients << " current patient(s), "
+                     << (it == roomToIndices.end() ? 0 : it->second.size()) << " total assignment(s))\n";
+            }
+            
+            if (currentPatients > 1) {
+                cout << "  WARNING: Room is overbooked!\n";
+            }
+        }
+        
+        while (true) {
+            cout << "\nEnter room number (1-200): ";
+            cin >> roomNumber;
+            
+            if (roomNumber < 1 || roomNumber > 200) {
+                cout << "\nError: Room number must be between 1 and 200\n";
+                system("pause");
+                continue;
+            }
+            
+            if (roomOccupancy.isFreeFor(roomNumber, requestedAdmission, requestedDischarge)) {
+                break;
+            }
+            cout << "\nError: Room " << roomNumber << " is occupied during the requested stay.\n";
+            cout << "Please select another room from the available list above.\n";
+        }
+
+        try {
+            Patient tempPatient(nextPatientId, name, medHistory, department, 
+                               condition, admissionDateStr, dischargeDateStr, roomNumber);
+            
+            if (!isValidPatient(tempPatient)) {
+                cout << "\nError: Invalid patient data. Cannot add patient.\n";
+                cout << "Please check all fields and try again.\n";
+                return;
+            }
+
+            // Add patient to system
+            applyUpsert(tempPatient);
+            
+            cout << "\nPatient added successfully!\n";
+            cout << "Patient ID: " << tempPatient.id << "\n";
+            cout << "Room Number: " << roomNumber << "\n";
+            cout << "Department: " << department << "\n";
+            
+            persist('A', tempPatient.toCSV());
+        } catch (const invalid_argument& e) {
+            cout << "\nError: " << e.what() << "\n";
+            cout << "Please try again with valid information.\n";
+            return;
+        }
+    }
+    bool isValidPatient(const Patient& patient) const {
+        string problem = validationError(patient);
+        if (!problem.empty()) {
+            cout << "Error: " << problem << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Returns why patient cannot be stored, or "" if it can. New records
+    // must also have an id that is not in use yet. The room must be free for
+    // the whole stay, not counting the record's own current stay; an edit
+    // that keeps room and dates is not re-checked, so records that a data
+    // file already double-booked can still be edited.
+    string validationError(const Patient& patient, bool requireNewId = true) const {
+        auto existing = idToIndex.find(patient.id);
+        if (requireNewId && existing != idToIndex.end()) {
+            return "Patient ID already exists.";
+        }
+        if (patient.id <= 0) {
+            return "Invalid patient ID. ID must be a positive number.";
+        }
+        if (patient.roomNumber < 1 || patient.roomNumber > 200) {
+            return "Room number must be between 1 and 200.";
+        }
+        if (patient.name.empty()) {
+            return "Patient name cannot be empty.";
+        }
+        for (const string* field : {&patient.name, &patient.medicalHistory, &patient.department, &patient.condition}) {
+            if (field->find_first_of(",\r\n") != string::npos) {
+                return "Fields cannot contain commas or line breaks.";
+            }
+        }
+        if (!patient.admissionDate.isValid()) {
+            return "Invalid admission date.";
+        }
+        if (patient.dischargeDate.isValid() && !(patient.admissionDate < patient.dischargeDate)) {
+            return "Discharge date must be after admission date.";
+        }
+        int self = existing == idToIndex.end() ? -1 : existing->second;
+        if (self >= 0) {
+            const PatientRecord& current = patients[self];
+            if (current.roomNumber == patient.roomNumber && current.admissionDate == patient.admissionDate &&
+                current.dischargeDate == patient.dischargeDate) {
+                return "";
+            }
+        }
+        if (!roomOccupancy.isFreeFor(patient.roomNumber, patient.admissionDate, patient.dischargeDate, self)) {
+            return "Room " + to_string(patient.roomNumber) + " is occupied during the requested stay.";
+        }
+        return "";
+    }
+
+    void updatePatient() {
+        int id;
+        cout << "Enter patient ID to update: ";
+        cin >> id;
+        
+        
+        auto it = idToIndex.find(id);
+        if (it == idToIndex.end()) {
+            cout << "Patient with ID " << id << " not found." << endl;
+            return;
+        }
+        
+        int idx = it->second;
+        Patient patient = patients[idx].toPatient();
+        
+        int choice;
+        cout << "What do you want to update?\n"
+             << "1. Name\n"
+             << "2. Medical History\n"
+             << "3. Department\n"
+             << "4. Condition\n"
+             << "5. Admission Date\n"
+             << "6. Discharge Date\n"
+             << "7. Room Number\n"
+             << "Choice: ";
+        cin >> choice;
+        
+        cin.ignore();
+        string newValue;
+        
+        try {
+            switch (choice) {
+                case 1:
+                    cout << "Enter new name: ";
+                    getline(cin, newValue);
+                    patient.name = newValue;
+                    break;
+                case 2:
+                    cout << "Enter new medical history: ";
+                    getline(cin, newValue);
+                    patient.medicalHistory = newValue;
+                    break;
+                case 3:
+                    cout << "Enter new department: ";
+                    getline(cin, newValue);
+                    patient.department = newValue;
+                    break;
+                case 4:
+                    cout << "Enter new condition: ";
+                    getline(cin, newValue);
+                    patient.condition = newValue;
+                    break;
+                case 5:
+                    cout << "Enter new admission date (DD-MM-YYYY): ";
+                    getline(cin, newValue);
+                    patient.admissionDate = Date(newValue);
+                    break;
+                case 6:
+                    cout << "Enter new discharge date (DD-MM-YYYY): ";
+                    getline(cin, newValue);
+                    patient.dischargeDate = Date(newValue);
+                    break;
+                case 7:
+                    int newRoom;
+                    cout << "Enter new room number: ";
+                    cin >> newRoom;
+                    patient.roomNumber = newRoom;
+                    break;
+                default:
+                    cout << "Invalid choice.\n";
+                    return;
+            }
+        } catch (const invalid_argument& e) {
+            cout << "\nError: " << e.what() << "\n";
+            return;
+        }
+
+        // same checks as updatePatientRecord, so the journal record replays
+        string problem = validationError(patient, false);
+        if (!problem.empty()) {
+            cout << "Error: " << problem << "\n";
+            return;
+        }
+        
+        cout << "Patient updated successfully.\n";
+        applyUpsert(patient);
+        persist('U', patient.toCSV());
+    }
+
+    void deletePatient() {
+        int id;
+        cout << "Enter patient ID to delete: ";
+        cin >> id;
+        
+        
+        auto it = idToIndex.find(id);
+        if (it == idToIndex.end()) {
+            cout << "Patient with ID " << id << " not found." << endl;
+            return;
+        }
+        
+        applyDelete(id);
+        cout << "Patient with ID " << id << " deleted successfully." << endl;
+        
+        persist('D', to_string(id));
+    }
+
+    unordered_map<int, int>::const_iterator lookupId(int id) const {
+        HMS_PERF_SCOPE(PerfLookupId);
+        return idToIndex.find(id);
+    }
+
+    void searchById() {
+        cout << "\nEnter patient ID to search: ";
+        int id;
+        cin >> id;
+        
+        auto it = lookupId(id);
+        if (it != idToIndex.end()) {
+            patients[it->second].display();
+        } else {
+            cout << "\nNo patient found with ID: " << id << "\n";
+        }
+    }
+
+    // Name lookups through the trigram index; results are record indices.
+    vector<int> findByNameContaining(const string& text) const {
+        HMS_PERF_SCOPE(PerfLookupName);
+        return nameSearch.containing(text);
+    }
+
+    vector<int> findByNamePrefix(const string& prefix) const {
+        HMS_PERF_SCOPE(PerfLookupName);
+        return nameSearch.withPrefix(prefix);
+    }
+
+    vector<int> findBySimilarName(const string& text, size_t limit = 10) const {
+        HMS_PERF_SCOPE(PerfLookupName);
+        return nameSearch.similarTo(text, limit);
+    }
+
+    void searchByName() {
+        string name;
+        cin.ignore();
+        cout << "Enter patient name (or partial name): ";
+        getline(cin, name);
+        
+        vector<int> results = findByNameContaining(name);
+        
+        if (results.empty()) {
+            vector<int> suggestions = findBySimilarName(name);
+            cout << "No patients found with name containing '" << name << "'." << endl;
+            if (!suggestions.empty()) {
+                cout << "Did you mean:\n";
+                for (int idx : suggestions) {
+                    cout << "- " << patients[idx].name.str() << " (ID " << patients[idx].id << ")\n";
+                }
+            }
+            return;
+        }
+        
+        cout << "Found " << results.size() << " patients:\n";
+        listRecords(results);
+    }
+
+    // Residual check that reads only the columnar mirror; text predicates
+    // fall back to the record itself.
+    bool matchesPredicate(int slot, const QueryPredicate& predicate) const {
+        uint32_t admission = columns.admissions[slot];
+        uint32_t discharge = columns.discharges[slot];
+        switch (predicate.field) {
+            case QueryId:
+                return columns.ids[slot] >= predicate.low && columns.ids[slot] <= predicate.high;
+            case QueryRoom:
+                return columns.rooms[slot] >= predicate.low && columns.rooms[slot] <= predicate.high;
+            case QueryAdmitted:
+                return admission != 0 && predicate.from.packed() <= admission && admission <= predicate.to.packed();
+            case QueryDischarged:
+                return discharge != 0 && predicate.from.packed() <= discharge && discharge <= predicate.to.packed();
+            case QueryActive:
+                return admission != 0 && admission <= predicate.from.packed() &&
+                       (discharge == 0 || predicate.from.packed() < discharge);
+            default:
+                return matchesPredicate(patients[slot], predicate);
+        }
+    }
+
+    template <typename Record>
+    bool matchesPredicate(const Record& patient, const QueryPredicate& predicate) const {
+        switch (predicate.field) {
+            case QueryId:
+                return patient.id >= predicate.low && patient.id <= predicate.high;
+            case QueryName:
+                return foldCase(patient.name).find(foldCase(predicate.text)) != string::npos;
+            case QueryDepartment:
+                return CaseInsensitiveEqual()(patient.department(), predicate.text);
+            case QueryCondition:
+                return CaseInsensitiveEqual()(patient.condition(), predicate.text);
+            case QueryRoom:
+                return patient.roomNumber >= predicate.low && patient.roomNumber <= predicate.high;
+            case QueryAdmitted:
+                return patient.admissionDate.isValid() && predicate.from <= patient.admissionDate &&
+                       patient.admissionDate <= predicate.to;
+            case QueryDischarged:
+                return patient.dischargeDate.isValid() && predicate.from <= patient.dischargeDate &&
+                       patient.dischargeDate <= predicate.to;
+            case QueryActive:
+                return patient.admissionDate.isValid() && patient.admissionDate <= predicate.from &&
+                       (!patient.dischargeDate.isValid() || predicate.from < patient.dischargeDate);
+        }
+        return false;
+    }
+
+    // Upper bound on the number of records an index lookup for predicate
+    // returns, or -1 if no index serves it.
+    long long estimateMatches(const QueryPredicate& predicate) const {
+        uint32_t code;
+        switch (predicate.field) {
+            case QueryId:
+                return predicate.low == predicate.high ? 1 : -1;
+            case QueryName:
+                return nameSearch.estimateContaining(predicate.text);
+            case QueryDepartment:
+                return codes.departments.find(predicate.text, code) && code < departmentToIndices.size()
+                    ? departmentToIndices[code].size() : 0;
+            case QueryCondition:
+                return codes.conditions.find(predicate.text, code) && code < conditionToIndices.size()
+                    ? conditionToIndices[code].size() : 0;
+            case QueryRoom: {
+                if (predicate.low != predicate.high) return -1;
+                auto it = roomToIndices.find(predicate.low);
+                return it == roomToIndices.end() ? 0 : it->second.size();
+            }
+            case QueryAdmitted:
+                return admissionIndex.countInRange(predicate.from, predicate.to);
+            case QueryDischarged:
+                return dischargeIndex.countInRange(predicate.from, predicate.to);
+            case QueryActive:
+                return -1;
+        }
+        return -1;
+    }
+
+    // Sorted record indices for an index-served predicate.
+    vector<int> lookupPredicate(const QueryPredicate& predicate) const {
+        vector<int> result;
+        uint32_t code;
+        switch (predicate.field) {
+            case QueryId: {
+                auto it = idToIndex.find(predicate.low);
+                if (it != idToIndex.end()) result.push_back(it->second);
+                return result;
+            }
+            case QueryName:
+                return nameSearch.containing(predicate.text);
+            case QueryDepartment:
+                if (codes.departments.find(predicate.text, code) && code < departmentToIndices.size()) {
+                    result = departmentToIndices[code];
+                }
+                return result;
+            case QueryCondition:
+                if (codes.conditions.find(predicate.text, code) && code < conditionToIndices.size()) {
+                    result = conditionToIndices[code];
+                }
+                return result;
+            case QueryRoom: {
+                auto it = roomToIndices.find(predicate.low);
+                if (it != roomToIndices.end()) result = it->second;
+                return result;
+            }
+            case QueryAdmitted:
+                result = admissionIndex.range(predicate.from, predicate.to);
+                break;
+            case QueryDischarged:
+                result = dischargeIndex.range(predicate.from, predicate.to);
+                break;
+            default:
+                for (int i = 0; i < patients.slotCount(); i++) {
+                    if (patients.isLive(i) && matchesPredicate(i, predicate)) result.push_back(i);
+                }
+                return result;
+        }
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    // Evaluates a query and returns matching record indices in ascending
+    // order. Conjunctions start from the most selective index, intersect
+    // with other indexed terms while their lists are comparably small, and
+    // check the remaining terms per candidate.
+    vector<int> runQuery(const PatientQuery& query) const {
+        HMS_PERF_SCOPE(PerfQuery);
+        vector<int> result;
+        if (query.terms.empty()) {
+            return result;
+        }
+
+        if (query.matchAny) {
+            for (const auto& predicate : query.terms) {
+                vector<int> matches = lookupPredicate(predicate);
+                vector<int> merged;
+                set_union(result.begin(), result.end(), matches.begin(), matches.end(), back_inserter(merged));
+                result.swap(merged);
+            }
+            return result;
+        }
+
+        vector<pair<long long, size_t>> indexed;
+        vector<size_t> residual;
+        for (size_t i = 0; i < query.terms.size(); i++) {
+            long long estimate = estimateMatches(query.terms[i]);
+            if (estimate < 0) {
+                residual.push_back(i);
+            } else {
+                indexed.push_back(make_pair(estimate, i));
+            }
+        }
+        sort(indexed.begin(), indexed.end());
+
+        vector<int> candidates;
+        if (indexed.empty()) {
+            candidates.reserve(patients.size());
+            for (int i = 0; i < patients.slotCount(); i++) {
+                if (patients.isLive(i)) candidates.push_back(i);
+            }
+        } else {
+            candidates = lookupPredicate(query.terms[indexed[0].second]);
+        }
+        for (size_t k = 1; k < indexed.size(); k++) {
+            if (candidates.empty()) {
+                return candidates;
+            }
+            const QueryPredicate& predicate = query.terms[indexed[k].second];
+            if (indexed[k].first <= static_cast<long long>(candidates.size()) * 16) {
+                candidates = intersectPostings(candidates, lookupPredicate(predicate));
+            } else {
+                residual.push_back(indexed[k].second);
+            }
+        }
+
+        for (int idx : candidates) {
+            bool keep = true;
+            for (size_t term : residual) {
+                if (!matchesPredicate(idx, query.terms[term])) {
+                    keep = false;
+                    break;
+                }
+            }
+            if (keep) {
+                result.push_back(idx);
+            }
+        }
+        return result;
+    }
+
+    void advancedQuery() {
+        string text;
+        cin.ignore();
+        cout << "Fields: id, name, department, condition, room, admitted, discharged, active\n"
+             << "Example: department=Cardiology condition=Critical admitted=01-03-2025..31-03-2025 active\n"
+             << "Enter query: ";
+        getline(cin, text);
+
+        PatientQuery query;
+        string error;
+        if (!PatientQuery::parse(text, query, error)) {
+            cout << "\nError: " << error << "\n";
+            return;
+        }
+        vector<int> results = runQuery(query);
+        if (results.empty()) {
+            cout << "\nNo patients match the query.\n";
+            return;
+        }
+        cout << "\nFound " << results.size() << " patients:\n";
+        listRecords(results);
+    }
+
+    // Date-index lookups; results are record indices in date order.
+    vector<int> admittedBetween(const Date& from, const Date& to) const {
+        HMS_PERF_SCOPE(PerfLookupDate);
+        return admissionIndex.range(from, to);
+    }
+
+    vector<int> admittedOn(const Date& day) const {
+        HMS_PERF_SCOPE(PerfLookupDate);
+        return admissionIndex.on(day);
+    }
+
+    vector<int> dischargedBetween(const Date& from, const Date& to) const {
+        HMS_PERF_SCOPE(PerfLookupDate);
+        return dischargeIndex.range(from, to);
+    }
+
+    void searchByDateRange() {
+        cout << "\nEnter start date (DD-MM-YYYY): ";
+        string startDateStr;
+        cin.ignore();
+        getline(cin, startDateStr);
+        
+        cout << "\nEnter end date (DD-MM-YYYY): ";
+        string endDateStr;
+        getline(cin, endDateStr);
+        
+        try {
+            Date startDate(startDateStr);
+            Date endDate(endDateStr);
+            
+            cout << "\nPatients admitted between " << startDate.toString() << " and " << endDate.toString() << ":\n";
+            vector<int> results = admittedBetween(startDate, endDate);
+            listRecords(results);
+            
+            if (results.empty()) {
+                cout << "\nNo patients found in the specified date range.\n";
+            }
+        } catch (const invalid_argument& e) {
+            cout << "\nError: " << e.what() << "\n";
+            cout << "Please enter valid dates in DD-MM-YYYY format.\n";
+        }
+    }
+
+    void showPatientsByDepartment() {
+        cout << "Available departments:\n";
+        const CensusCounts& census = dashboard.view().census;
+        for (size_t code = 0; code < departmentToIndices.size(); code++) {
+            if (departmentToIndices[code].empty()) {
+                continue;
+            }
+            size_t activePatients = code < census.departmentAdmitted.size() ? census.departmentAdmitted[code] : 0;
+            cout << "- " << codes.departments.value(code) << " (" << activePatients << " active patients)\n";
+        }
+        
+        string department;
+        cin.ignore();
+        cout << "Enter department name: ";
+        getline(cin, department);
+        
+        uint32_t code;
+        if (codes.departments.find(department, code) && code < departmentToIndices.size() &&
+            !departmentToIndices[code].empty()) {
+            cout << "\nPatients in department " << department << ":\n";
+            listRecords(departmentToIndices[code]);
+        } else {
+            cout << "\nNo patients found in department: " << department << "\n";
+        }
+    }
+
+    void showPatientsByCondition() {
+        cout << "Available conditions:\n";
+        for (size_t code = 0; code < conditionToIndices.size(); code++) {
+            if (!conditionToIndices[code].empty()) {
+                cout << "- " << codes.conditions.value(code) << " ("
+                     << conditionToIndices[code].size() << " patients)\n";
+            }
+        }
         
-        file << "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+        string condition;
+        cin.ignore();
+        cout << "Enter condition: ";
+        getline(cin, condition);
         
-        for (const auto& patient : patients) {
-            file << patient.toCSV() << endl;
+        uint32_t code;
+        if (codes.conditions.find(condition, code) && code < conditionToIndices.size() &&
+            !conditionToIndices[code].empty()) {
+            cout << "\nPatients with condition " << condition << ":\n";
+            listRecords(conditionToIndices[code]);
+        } else {
+            cout << "\nNo patients found with condition: " << condition << "\n";
+        }
+    }
+    
+    void showPatientsByRoom() {
+        cout << "\nEnter room number: ";
+        int room;
+        cin >> room;
+        
+        if (room < 1 || room > 200) {
+            cout << "\nError: Room number must be between 1 and 200\n";
+            return;
         }
         
-        cout << "Saved " << patients.size() << " patient records to " << csvFilename << endl;
+        auto it = roomToIndices.find(room);
+        if (it != roomToIndices.end()) {
+            if (it->second.empty()) {
+                cout << "\nNo patients found in room: " << room << "\n";
+                return;
+            }
+            cout << "\nPatients in room " << room << ":\n";
+            listRecords(it->second, true);
+        } else {
+            cout << "\nNo patients found in room: " << room << "\n";
+            cout << "Press any key to continue...\n";
+            system("pause");
+        }
     }
 
-    bool isRoomAvailable(int roomNumber) const {
-        if (roomNumber < 1 || roomNumber > 200) {
-            throw invalid_argument("Room number must be between 1 and 200");
+    void displayAllPatients() {
+        if (patients.empty()) {
+            cout << "No patient records found.\n";
+            return;
         }
         
-        auto it = roomToIndices.find(roomNumber);
-        if (it == roomToIndices.end()) {
-            return true;  
+        cout << "Total patients: " << patients.size() << endl;
+        RecordWriter writer(cout, OutputRecord);
+        attachConsolePager(writer, true);
+        for (const auto& patient : patients) {
+            if (!writer.write(patient)) {
+                break;
+            }
         }
+    }
 
-        for (int idx : it->second) {
-            const Patient& patient = patients[idx];
-            if (patient.admissionDate.isValid() && 
-                (!patient.dischargeDate.isValid() || 
-                 (Date() < patient.dischargeDate))) {  
-                return false;
+    void showPerformance() const {
+        string lines;
+        perfRegistry().appendCSV(lines);
+        cout << "\n=== Performance Counters (microseconds) ===\n";
+        cout << left << setw(14) << "Operation" << right << setw(10) << "Count" << setw(12) << "Mean"
+             << setw(12) << "p50" << setw(12) << "p90" << setw(12) << "p99" << setw(12) << "Max" << "\n";
+        istringstream rows(lines);
+        string row;
+        while (getline(rows, row)) {
+            stringstream fields(row);
+            string field;
+            getline(fields, field, ',');
+            cout << left << setw(14) << field << right;
+            for (int column = 0; getline(fields, field, ','); column++) {
+                cout << setw(column == 0 ? 10 : 12) << field;
             }
+            cout << "\n";
         }
-        return true;
+        if (lines.empty()) {
+            cout << "No operations recorded yet.\n";
+        }
+#ifdef HMS_DISABLE_PERF
+        cout << "(built with HMS_DISABLE_PERF; timers are compiled out)\n";
+#endif
     }
 
+    void showStatistics() {
+        if (patients.empty()) {
+            cout << "No patient records found.\n";
+            return;
+        }
+        printStatistics(dashboard.view());
+    }
 
-
-    void addPatient() {
-        string name, medHistory, department, condition;
-        string admissionDateStr, dischargeDateStr;
-        int roomNumber;
+    void printStatistics(const StatisticsReport& report, ostream& target = cout) const {
+        ostringstream out;
+        out << "\n=== Hospital Statistics ===\n";
+        out << "Total patients: " << report.total << endl;
         
-        cin.ignore();
+        // Count patients by department
+        out << "\nPatients by Department:\n";
+        for (size_t code = 0; code < report.departmentTotals.size(); code++) {
+            if (report.departmentTotals[code] != 0) {
+                out << "- " << codes.departments.value(code) << ": " << report.departmentTotals[code] << endl;
+            }
+        }
         
-        system("cls");
-        cout << "\n=== Add New Patient ===\n";
-        cout << "Please fill in the patient information:\n\n";
+        // Count patients by condition
+        out << "\nPatients by Condition:\n";
+        for (size_t code = 0; code < report.conditionTotals.size(); code++) {
+            if (report.conditionTotals[code] != 0) {
+                out << "- " << codes.conditions.value(code) << ": " << report.conditionTotals[code] << endl;
+            }
+        }
         
-        while (true) {
-            cout << "Enter patient name (2-50 characters): ";
-            getline(cin, name);
-            if (name.length() >= 2 && name.length() <= 50) {
-                break;
+        out << "\nCurrently admitted patients: " << report.census.admitted << endl;
+        out << "Discharged patients: " << report.census.discharged << endl;
+
+        // Length of stay for completed stays, grouped into coarse buckets
+        static const int bucketEnds[] = {1, 3, 7, 14, 30, 90, StatisticsReport::maxStayDays};
+        out << "\nLength of Stay (completed stays):\n";
+        int bucketStart = 0;
+        for (int bucketEnd : bucketEnds) {
+            size_t stays = 0;
+            for (int days = bucketStart; days <= bucketEnd; days++) stays += report.stayDays[days];
+            out << "- " << bucketStart << "-" << bucketEnd << " days: " << stays << endl;
+            bucketStart = bucketEnd + 1;
+        }
+        out << "- over " << StatisticsReport::maxStayDays << " days: "
+            << report.stayDays[StatisticsReport::maxStayDays + 1] << endl;
+        
+        // Room utilization
+        out << "\nRoom Utilization (1-200):\n";
+        for (int i = 1; i < static_cast<int>(report.roomAssignments.size()); i++) {
+            int currentPatients = report.census.roomOccupants[i];
+            if (currentPatients == 0) {
+                out << "- Room " << i << ": Available (0 current patients)\n";
+            } else {
+                out << "- Room " << i << ": Occupied (" 
+                    << currentPatients << " current patient(s), "
+                    << report.roomAssignments[i] << " total assignment(s))\n";
             }
-            cout << "Error: Name must be between 2 and 50 characters\n";
+            
+            if (currentPatients > 1) {
+                out << "  WARNING: Room is overbooked!\n";
+            }
+        }
+
+        vector<pair<int, int>> overbooked = getOverbookedStays();
+        out << "\nOverlapping room stays: " << overbooked.size() << endl;
+        for (const auto& stays : overbooked) {
+            const PatientRecord& first = patients[stays.first];
+            const PatientRecord& second = patients[stays.second];
+            out << "- Room " << first.roomNumber << ": patient " << first.id
+                << " (" << first.admissionDate.toString() << " to " << first.dischargeDate.toString()
+                << ") overlaps patient " << second.id
+                << " (" << second.admissionDate.toString() << " to " << second.dischargeDate.toString() << ")\n";
+        }
+        target << out.str();
+    }
+
+    // Longest range the menu and command line will build a series for.
+    static const int maxSeriesDays = 3660;
+
+    void showCensus() {
+        string text;
+        cin.ignore();
+        cout << "\nEnter a date or range (DD-MM-YYYY or DD-MM-YYYY..DD-MM-YYYY, blank for today): ";
+        getline(cin, text);
+
+        Date from = roomOccupancy.getToday();
+        Date to = from;
+        try {
+            if (!text.empty() && !PatientQuery::parseDateRange(text, from, to)) {
+                throw invalid_argument("Invalid date. Please enter a valid date");
+            }
+        } catch (const invalid_argument& e) {
+            cout << "\nError: " << e.what() << "\n";
+            return;
+        }
+        if (to < from || from.daysUntil(to) >= maxSeriesDays) {
+            cout << "\nError: The range must run forwards and span at most " << maxSeriesDays << " days\n";
+            return;
+        }
+        if (from == to) {
+            printCensus(censusOn(from));
+        } else {
+            printOccupancy(occupancyBetween(from, to));
+        }
+    }
+
+    void printCensus(const DayCensus& census, ostream& target = cout) const {
+        string out = "\n=== Census on ";
+        appendDate(out, census.day);
+        out += " ===\nPatients in hospital: ";
+        appendInt(out, census.patients);
+        out += "\nOccupied rooms: ";
+        appendInt(out, census.occupiedRooms);
+        out += "\n\nBy department:\n";
+        for (size_t code = 0; code < census.departments.size(); code++) {
+            if (census.departments[code] == 0) continue;
+            out += "- " + codes.departments.value(code) + ": ";
+            appendInt(out, census.departments[code]);
+            out += '\n';
+        }
+        target << out;
+    }
+
+    // Length-of-stay and throughput report over a range, the full history
+    // by default, with admissions and discharges per day or week.
+    void showStayAnalytics() {
+        string text, by;
+        cin.ignore();
+        cout << "\nEnter a range (DD-MM-YYYY..DD-MM-YYYY, blank for the full history): ";
+        getline(cin, text);
+        cout << "Count admissions and discharges per day or week? (d/w, blank for week): ";
+        getline(cin, by);
+
+        Date from, to;
+        try {
+            if (text.empty()) {
+                historySpan(from, to);
+            } else if (!PatientQuery::parseDateRange(text, from, to)) {
+                throw invalid_argument("Invalid date range. Please enter DD-MM-YYYY..DD-MM-YYYY");
+            }
+        } catch (const invalid_argument& e) {
+            cout << "\nError: " << e.what() << "\n";
+            return;
+        }
+        int periodDays = !by.empty() && tolower(static_cast<unsigned char>(by[0])) == 'd' ? 1 : 7;
+        if (!from.isValid()) {
+            cout << "\nNo admissions on record.\n";
+            return;
+        }
+        if (!validStayWindow(from, to, periodDays)) {
+            cout << "\nError: The range must run forwards and span at most " << maxSeriesDays
+                 << " days (or weeks)\n";
+            return;
+        }
+        StayAnalytics analytics;
+        stayAnalyticsBetween(from, to, periodDays, analytics);
+        printStayAnalytics(analytics);
+    }
+
+    static bool validStayWindow(const Date& from, const Date& to, int periodDays) {
+        return from.isValid() && to.isValid() && !(to < from) &&
+               from.daysUntil(to) / periodDays < maxSeriesDays;
+    }
+
+    void printStayAnalytics(const StayAnalytics& analytics, ostream& target = cout) const {
+        const StayStats& all = analytics.hospital;
+        char line[200];
+        string out = "\n=== Length of Stay and Throughput, ";
+        appendDate(out, analytics.from);
+        out += " to ";
+        appendDate(out, analytics.to);
+        out += " ===\nAdmissions: ";
+        appendInt(out, static_cast<long long>(all.admissions));
+        out += "\nDischarges: ";
+        appendInt(out, static_cast<long long>(all.discharges));
+        snprintf(line, sizeof(line),
+                 "\nCompleted stays: %llu (mean %.1f days, median %llu, p90 %llu, p99 %llu, max %llu)\n"
+                 "Bed turnover: %.2f discharges per bed (%d beds)\n",
+                 static_cast<unsigned long long>(all.lengths.count()), all.lengths.mean(),
+                 static_cast<unsigned long long>(all.lengths.percentile(0.5)),
+                 static_cast<unsigned long long>(all.lengths.percentile(0.9)),
+                 static_cast<unsigned long long>(all.lengths.percentile(0.99)),
+                 static_cast<unsigned long long>(all.lengths.max()), analytics.hospitalTurnover(), analytics.roomLimit);
+        out += line;
+
+        for (int byCondition = 0; byCondition < 2; byCondition++) {
+            const vector<StayStats>& groups = byCondition ? analytics.conditions : analytics.departments;
+            const StringDictionary& names = byCondition ? codes.conditions : codes.departments;
+            out += byCondition ? "\nBy condition:\n" : "\nBy department:\n";
+            snprintf(line, sizeof(line), "%-24s %8s %10s %8s %5s %5s %5s %9s\n", "", "Admitted", "Discharged",
+                     "Mean LOS", "p50", "p90", "p99", "Turnover");
+            out += line;
+            for (size_t code = 0; code < groups.size(); code++) {
+                const StayStats& group = groups[code];
+                if (group.admissions == 0 && group.discharges == 0) continue;
+                snprintf(line, sizeof(line), "%-24s %8llu %10llu %8.1f %5llu %5llu %5llu %9.2f\n",
+                         names.value(code).c_str(), static_cast<unsigned long long>(group.admissions),
+                         static_cast<unsigned long long>(group.discharges), group.lengths.mean(),
+                         static_cast<unsigned long long>(group.lengths.percentile(0.5)),
+                         static_cast<unsigned long long>(group.lengths.percentile(0.9)),
+                         static_cast<unsigned long long>(group.lengths.percentile(0.99)), StayAnalytics::groupTurnover(group));
+                out += line;
+            }
+        }
+
+        out += analytics.periodDays == 1 ? "\nDay         Admitted  Discharged\n" : "\nWeek of     Admitted  Discharged\n";
+        for (size_t period = 0; period < analytics.periods; period++) {
+            appendDate(out, analytics.periodStart(period));
+            snprintf(line, sizeof(line), "  %8u  %10u\n", all.admitted[period], all.discharged[period]);
+            out += line;
+        }
+        target << out;
+    }
+
+    // One CSV row per group with any admission or discharge in the range:
+    // Group,Name,Admissions,Discharges,Stays,MeanDays,P50Days,P90Days,
+    // P99Days,MaxDays,Turnover. Returns the number of rows, without the header.
+    size_t appendStaySummaryCSV(string& out, const StayAnalytics& analytics, bool header) const {
+        if (header) {
+            out += "Group,Name,Admissions,Discharges,Stays,MeanDays,P50Days,P90Days,P99Days,MaxDays,Turnover\n";
+        }
+        size_t rows = 0;
+        auto appendRow = [&](const char* kind, const string& name, const StayStats& group, double turnover) {
+            char numbers[160];
+            snprintf(numbers, sizeof(numbers), ",%llu,%llu,%llu,%.2f,%llu,%llu,%llu,%llu,%.3f\n",
+                     static_cast<unsigned long long>(group.admissions),
+                     static_cast<unsigned long long>(group.discharges),
+                     static_cast<unsigned long long>(group.lengths.count()), group.lengths.mean(),
+                     static_cast<unsigned long long>(group.lengths.percentile(0.5)),
+                     static_cast<unsigned long long>(group.lengths.percentile(0.9)),
+                     static_cast<unsigned long long>(group.lengths.percentile(0.99)),
+                     static_cast<unsigned long long>(group.lengths.max()), turnover);
+            out += kind;
+            out += ',';
+            out += name;
+            out += numbers;
+            rows++;
+        };
+        appendRow("hospital", "All", analytics.hospital, analytics.hospitalTurnover());
+        for (size_t code = 0; code < analytics.departments.size(); code++) {
+            const StayStats& group = analytics.departments[code];
+            if (group.admissions == 0 && group.discharges == 0) continue;
+            appendRow("department", codes.departments.value(code), group, StayAnalytics::groupTurnover(group));
+        }
+        for (size_t code = 0; code < analytics.conditions.size(); code++) {
+            const StayStats& group = analytics.conditions[code];
+            if (group.admissions == 0 && group.discharges == 0) continue;
+            appendRow("condition", codes.conditions.value(code), group, StayAnalytics::groupTurnover(group));
+        }
+        return rows;
+    }
+
+    // Admissions and discharges per period in long form:
+    // PeriodStart,Group,Name,Admitted,Discharged. The hospital row is written
+    // for every period, department and condition rows only when nonzero.
+    void appendStaySeriesCSV(string& out, const StayAnalytics& analytics) const {
+        out += "PeriodStart,Group,Name,Admitted,Discharged\n";
+        auto appendRow = [&](size_t period, const char* kind, const string& name, const StayStats& group) {
+            if (group.admitted[period] == 0 && group.discharged[period] == 0 && &group != &analytics.hospital) return;
+            appendDate(out, analytics.periodStart(period));
+            out += ',';
+            out += kind;
+            out += ',';
+            out += name;
+            out += ',';
+            appendInt(out, group.admitted[period]);
+            out += ',';
+            appendInt(out, group.discharged[period]);
+            out += '\n';
+        };
+        for (size_t period = 0; period < analytics.periods; period++) {
+            appendRow(period, "hospital", "All", analytics.hospital);
+            for (size_t code = 0; code < analytics.departments.size(); code++) {
+                appendRow(period, "department", codes.departments.value(code), analytics.departments[code]);
+            }
+            for (size_t code = 0; code < analytics.conditions.size(); code++) {
+                appendRow(period, "condition", codes.conditions.value(code), analytics.conditions[code]);
+            }
+        }
+    }
+
+    // Daily curve as a text table, with the peak day at the end.
+    void printOccupancy(const OccupancySeries& series, ostream& target = cout) const {
+        string out = "\nDate        Patients  Occupied rooms\n";
+        size_t peak = 0;
+        for (size_t day = 0; day < series.days; day++) {
+            appendDate(out, series.from.addDays(static_cast<int>(day)));
+            size_t start = out.size();
+            appendInt(out, series.total[day]);
+            out.insert(start, 12 - min<size_t>(12, out.size() - start), ' ');
+            start = out.size();
+            appendInt(out, series.occupiedRooms[day]);
+            out.insert(start, 16 - min<size_t>(16, out.size() - start), ' ');
+            out += '\n';
+            if (series.total[day] > series.total[peak]) peak = day;
+        }
+        if (series.days > 0) {
+            out += "\nPeak: ";
+            appendInt(out, series.total[peak]);
+            out += " patients on ";
+            appendDate(out, series.from.addDays(static_cast<int>(peak)));
+            out += '\n';
+        }
+        target << out;
+    }
+
+    // One CSV row per day: Date,Patients,OccupiedRooms and then a column
+    // per department (or per room) that has any patient in the range.
+    void appendOccupancyCSV(string& out, const OccupancySeries& series, bool byRoom) const {
+        const vector<vector<uint32_t>>& groups = byRoom ? series.rooms : series.departments;
+        vector<size_t> used;
+        for (size_t group = 0; group < groups.size(); group++) {
+            if (!groups[group].empty() && *max_element(groups[group].begin(), groups[group].end()) > 0) {
+                used.push_back(group);
+            }
+        }
+        out += "Date,Patients,OccupiedRooms";
+        for (size_t group : used) {
+            out += ',';
+            if (byRoom) {
+                out += "Room ";
+                appendInt(out, static_cast<long long>(group));
+            } else {
+                out += codes.departments.value(group);
+            }
+        }
+        out += '\n';
+        for (size_t day = 0; day < series.days; day++) {
+            appendDate(out, series.from.addDays(static_cast<int>(day)));
+            out += ',';
+            appendInt(out, series.total[day]);
+            out += ',';
+            appendInt(out, series.occupiedRooms[day]);
+            for (size_t group : used) {
+                out += ',';
+                appendInt(out, groups[group][day]);
+            }
+            out += '\n';
+        }
+    }
+};
+
+// Shape of a generated hospital. Department and condition popularity
+// follow a Zipf distribution with the given exponent (0 = uniform); stay
+// lengths are exponential around meanStayDays.
+struct SyntheticProfile {
+    size_t rows;
+    unsigned seed;
+    int departments;
+    int conditions;
+    double skew;
+    int meanStayDays;
+    int rooms;
+    double openStayFraction;   // share of records with no discharge date
+    int spanDays;              // admissions spread over this many days from 01-01-2015
+
+    SyntheticProfile()
+        : rows(100000), seed(42), departments(10), conditions(5), skew(1.0), meanStayDays(8),
+          rooms(200), openStayFraction(0.1), spanDays(3650) {}
+};
+
+// Deterministic stream of synthetic records for benchmarks and tests.
+class SyntheticHospital {
+private:
+    SyntheticProfile profile;
+    uint64_t state;
+    int nextId;
+    int firstDay;
+    vector<string> departmentNames;
+    vector<string> conditionNames;
+    vector<double> departmentWeights;   // cumulative
+    vector<double> conditionWeights;
+
+    static vector<double> zipf(int count, double exponent) {
+        vector<double> cumulative(count);
+        double total = 0;
+        for (int i = 0; i < count; i++) {
+            total += 1.0 / pow(i + 1.0, exponent);
+            cumulative[i] = total;
+        }
+        for (double& weight : cumulative) weight /= total;
+        return cumulative;
+    }
+
+    uint32_t random() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+
+    double uniform() {
+        return (random() + 0.5) / 2147483648.0;
+    }
+
+    size_t pick(const vector<double>& cumulative) {
+        size_t index = lower_bound(cumulative.begin(), cumulative.end(), uniform()) - cumulative.begin();
+        return min(index, cumulative.size() - 1);
+    }
+
+public:
+    explicit SyntheticHospital(const SyntheticProfile& profile)
+        : profile(profile), state(profile.seed * 6364136223846793005ULL + 1442695040888963407ULL), nextId(1),
+          firstDay(Date(1, 1, 2015).dayNumber()) {
+        for (int i = 0; i < profile.departments; i++) {
+            departmentNames.push_back(departmentName(i));
+        }
+        for (int i = 0; i < profile.conditions; i++) {
+            conditionNames.push_back(conditionName(i));
+        }
+        departmentWeights = zipf(profile.departments, profile.skew);
+        conditionWeights = zipf(profile.conditions, profile.skew);
+    }
+
+    static string departmentName(int i) {
+        static const char* departments[] = {"Cardiology", "Pulmonology", "Surgery", "Neurology", "Oncology",
+                                            "Endocrinology", "Gastroenterology", "Orthopedics", "Urology", "ENT"};
+        return i < 10 ? string(departments[i]) : "Department " + to_string(i + 1);
+    }
+
+    static string conditionName(int i) {
+        static const char* conditions[] = {"Stable", "Critical", "Recovering", "Improving", "Serious"};
+        return i < 5 ? string(conditions[i]) : "Condition " + to_string(i + 1);
+    }
+
+    static const char* firstName(size_t i) {
+        static const char* names[] = {"James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael",
+                                      "Linda", "David", "Elizabeth", "William", "Barbara", "Richard", "Susan",
+                                      "Joseph", "Jessica", "Thomas", "Sarah", "Priya", "Wei", "Aisha", "Kanav",
+                                      "Carlos", "Fatima", "Yuki", "Olga", "Ahmed", "Lucia", "Noah", "Emma"};
+        return names[i % (sizeof(names) / sizeof(names[0]))];
+    }
+
+    static const char* lastName(size_t i) {
+        static const char* names[] = {"Smith", "Johnson", "Williams", "Brown", "Jones", "Garcia", "Miller",
+                                      "Davis", "Rodriguez", "Martinez", "Hernandez", "Lopez", "Gonzalez",
+                                      "Wilson", "Anderson", "Thomas", "Taylor", "Moore", "Jackson", "Martin",
+                                      "Lee", "Patel", "Kumar", "Chen", "Nguyen", "Kim", "Singh", "Ivanova",
+                                      "Okafor", "Benipuri", "Tanaka", "Rossi", "Muller", "Silva", "Haddad"};
+        return names[i % (sizeof(names) / sizeof(names[0]))];
+    }
+
+    Patient next() {
+        Date admission = Date::fromDayNumber(firstDay + static_cast<int>(random() % profile.spanDays));
+        Date discharge;
+        if (uniform() >= profile.openStayFraction) {
+            int stay = 1 + static_cast<int>(-log(uniform()) * max(0, profile.meanStayDays - 1));
+            discharge = admission.addDays(stay);
+        }
+        string name = string(firstName(random())) + " " + lastName(random());
+        return Patient(nextId++, name, "History", departmentNames[pick(departmentWeights)],
+                       conditionNames[pick(conditionWeights)], admission, discharge,
+                       1 + static_cast<int>(random() % profile.rooms));
+    }
+};
+
+inline void generateSyntheticPatients(SlotStore<PatientRecord>& records, TextArena& text, CodeDictionaries& codes,
+                                      size_t count, unsigned seed) {
+    SyntheticProfile profile;
+    profile.seed = seed;
+    SyntheticHospital hospital(profile);
+    records.reserve(records.size() + count);
+    for (size_t i = 0; i < count; i++) {
+        records.push_back(PatientRecord(hospital.next(), text, codes));
+    }
+}
+
+// Times the scans that were ported to the columnar mirror (census,
+// statistics and a date/room query filter) over the slot store (array of
+// structs) and over the columns, for each row count.
+//   hospital_system --bench-columnar [rows...]
+int benchmarkColumnar(const vector<size_t>& sizes) {
+    for (size_t rows : sizes) {
+        SlotStore<PatientRecord> records;
+        TextArena text;
+        CodeDictionaries codes;
+        generateSyntheticPatients(records, text, codes, rows, 42);
+        PatientColumns columns;
+        for (int slot = 0; slot < records.slotCount(); slot++) {
+            columns.set(slot, records[slot]);
+        }
+
+        const int repeats = 5;
+        Date day(1, 6, 2020);
+        size_t checksum = 0;
+        auto started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) checksum += 2 * censusOfRecords(records, codes, day, 200).admitted;
+        double rowSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) checksum -= columns.census(day, 200, censusKernelScalar).admitted;
+        double columnSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        CensusKernel kernel = activeCensusKernel();
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) checksum -= columns.census(day, 200, kernel).admitted;
+        double kernelSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+
+        cout << rows << " rows census: records " << fixed << setprecision(2) << rowSeconds * 1000 << " ms, columns "
+             << columnSeconds * 1000 << " ms (" << setprecision(1) << rowSeconds / columnSeconds << "x), "
+             << censusKernelName(kernel) << " " << setprecision(2) << kernelSeconds * 1000 << " ms ("
+             << setprecision(1) << rowSeconds / kernelSeconds << "x)"
+             << (checksum == 0 ? "" : " MISMATCH") << endl;
+
+        // single-threaded, so the comparison is about layout, not the pool
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            StatisticsReport report = statisticsOfRecords(records, codes, day, 200);
+            checksum += report.census.admitted + report.stayDays[3];
+        }
+        rowSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            StatisticsReport report;
+            accumulateStatistics(columns, day, 200, 0, columns.slotCount(), report);
+            checksum -= report.census.admitted + report.stayDays[3];
+        }
+        columnSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        cout << rows << " rows statistics: records " << fixed << setprecision(2) << rowSeconds * 1000
+             << " ms, columns " << columnSeconds * 1000 << " ms (" << setprecision(1)
+             << rowSeconds / columnSeconds << "x)" << (checksum == 0 ? "" : " MISMATCH") << endl;
+
+        // the residual check of "admitted=<month> room=1..50 active=<day>"
+        uint32_t monthStart = Date(1, 5, 2020).packed();
+        uint32_t key = day.packed();
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            for (const PatientRecord& patient : records) {
+                checksum += patient.admissionDate.isValid() && Date::fromPacked(monthStart) <= patient.admissionDate &&
+                            patient.admissionDate <= day && patient.roomNumber >= 1 && patient.roomNumber <= 50 &&
+                            (!patient.dischargeDate.isValid() || day < patient.dischargeDate);
+            }
+        }
+        rowSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        started = chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            for (size_t slot = 0; slot < columns.slotCount(); slot++) {
+                uint32_t admission = columns.admissions[slot];
+                uint32_t discharge = columns.discharges[slot];
+                checksum -= columns.live[slot] && admission != 0 && monthStart <= admission && admission <= key &&
+                            columns.rooms[slot] >= 1 && columns.rooms[slot] <= 50 &&
+                            (discharge == 0 || key < discharge);
+            }
+        }
+        columnSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+        cout << rows << " rows query filter: records " << fixed << setprecision(2) << rowSeconds * 1000
+             << " ms, columns " << columnSeconds * 1000 << " ms (" << setprecision(1)
+             << rowSeconds / columnSeconds << "x)" << (checksum == 0 ? "" : " MISMATCH") << endl;
+    }
+    return 0;
+}
+
+// Times computeStatistics on pools of 1, 2, 4, ... threads up to the
+// hardware concurrency.
+//   hospital_system --bench-statistics [rows...]
+int benchmarkStatistics(const vector<size_t>& sizes) {
+    size_t hardware = max(1u, thread::hardware_concurrency());
+    for (size_t rows : sizes) {
+        SlotStore<PatientRecord> records;
+        TextArena text;
+        CodeDictionaries codes;
+        generateSyntheticPatients(records, text, codes, rows, 42);
+        PatientColumns columns;
+        for (int slot = 0; slot < records.slotCount(); slot++) {
+            columns.set(slot, records[slot]);
+        }
+        Date day(1, 6, 2020);
+        double serialSeconds = 0;
+        for (size_t workers = 1; ; workers = min(hardware, workers * 2)) {
+            WorkerPool pool(workers);
+            const int repeats = 5;
+            size_t admitted = 0;
+            auto started = chrono::steady_clock::now();
+            for (int i = 0; i < repeats; i++) admitted += computeStatistics(columns, day, 200, pool).census.admitted;
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count() / repeats;
+            if (workers == 1) serialSeconds = seconds;
+            cout << rows << " rows, " << workers << " thread(s): " << fixed << setprecision(2) << seconds * 1000
+                 << " ms (" << setprecision(1) << serialSeconds / seconds << "x, " << admitted / repeats
+                 << " admitted)" << endl;
+            if (workers == hardware) break;
+        }
+    }
+    return 0;
+}
+
+// Writes profile.rows generated records to a CSV data file.
+void writeSyntheticCSV(const string& path, const SyntheticProfile& profile) {
+    SyntheticHospital generator(profile);
+    string buffer = "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+    for (size_t i = 0; i < profile.rows; i++) {
+        generator.next().appendCSV(buffer);
+        buffer += '\n';
+    }
+    ofstream file(path.c_str(), ios::binary);
+    file << buffer;
+}
+
+// Runs reader and writer threads against one HospitalSystem through its
+// thread-safe API, checking every answer against the query that produced it
+// and the indices against a full rebuild, during and after the run. Works on
+// a synthetic file that is removed afterwards.
+//   hospital_system --stress [readers] [writers] [seconds]
+int stressTest(int readers, int writers, int seconds) {
+    const size_t initialRows = 20000;
+    string path = "hms_stress_" + to_string(time(nullptr)) + ".csv";
+    {
+        SyntheticProfile profile;
+        profile.rows = initialRows;
+        profile.seed = 7;
+        writeSyntheticCSV(path, profile);
+    }
+
+    atomic<bool> stop(false);
+    atomic<size_t> reads(0), writes(0), failures(0);
+    atomic<long long> netAdded(0);
+    static const char* departments[] = {"Cardiology", "Surgery", "Oncology", "ENT"};
+    {
+        HospitalSystem hospital(path);
+        vector<thread> threads;
+        for (int r = 0; r < readers; r++) {
+            threads.push_back(thread([&, r] {
+                uint32_t state = 2463534242u + r;
+                auto next = [&state]() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; };
+                while (!stop) {
+                    Patient patient;
+                    int id = 1 + next() % (initialRows * 2);
+                    if (hospital.getPatient(id, patient) && patient.id != id) failures++;
+
+                    PatientQuery query;
+                    string department = departments[next() % 4];
+                    int room = 1 + next() % 200;
+                    query.terms.push_back(QueryPredicate::departmentIs(department));
+                    query.terms.push_back(QueryPredicate::roomIs(room));
+                    for (const Patient& match : hospital.queryPatients(query)) {
+                        if (match.roomNumber != room || !CaseInsensitiveEqual()(match.department, department)) failures++;
+                    }
+                    if (next() % 64 == 0) {
+                        StatisticsReport report = hospital.statisticsOn(Date(1, 6, 2020));
+                        if (report.census.admitted + report.census.discharged != report.total) failures++;
+                    }
+                    if (next() % 256 == 0 && !hospital.verifyIndices()) failures++;
+                    reads++;
+                }
+            }));
+        }
+        for (int w = 0; w < writers; w++) {
+            threads.push_back(thread([&, w] {
+                uint32_t state = 88675123u + w;
+                auto next = [&state]() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; };
+                string error;
+                while (!stop) {
+                    int action = next() % 3;
+                    if (action == 0) {
+                        Date admission = Date(1, 1, 2020).addDays(next() % 365);
+                        Patient patient(0, "Stress " + to_string(next()), "History", departments[next() % 4], "Stable",
+                                        admission.toString(), admission.addDays(1 + next() % 20).toString(),
+                                        1 + next() % 200);
+                        if (hospital.admitPatient(patient, error) > 0) netAdded++;
+                    } else {
+                        Patient patient;
+                        int id = 1 + next() % (initialRows * 2);
+                        if (!hospital.getPatient(id, patient)) continue;
+                        if (action == 1) {
+                            patient.roomNumber = 1 + next() % 200;
+                            patient.department = departments[next() % 4];
+                            hospital.updatePatientRecord(patient, error);
+                        } else if (hospital.removePatient(id)) {
+                            netAdded--;
+                        }
+                    }
+                    writes++;
+                }
+            }));
+        }
+        this_thread::sleep_for(chrono::seconds(seconds));
+        stop = true;
+        for (thread& worker : threads) worker.join();
+
+        if (!hospital.verifyIndices()) failures++;
+        if (static_cast<long long>(hospital.patientCount()) != static_cast<long long>(initialRows) + netAdded) failures++;
+        cout << "Stress: " << readers << " reader(s), " << writers << " writer(s), " << seconds << "s: "
+             << reads << " reads, " << writes << " writes, " << failures << " failure(s)" << endl;
+    }
+    remove(path.c_str());
+    remove((path + ".journal").c_str());
+    return failures == 0 ? 0 : 1;
+}
+
+// End-to-end benchmark over generated hospitals: load and save in both
+// formats, index lookups, the query engine, mutations through the
+// thread-safe API (journaled) and the statistics engine. Prints one JSON
+// document to stdout; progress goes to stderr. Scratch files are created in
+// the working directory and removed afterwards.
+//   hospital_system bench [--rows 10000,100000,1000000] [--departments N] [--conditions N]
+//                         [--skew S] [--stay-days N] [--rooms N] [--open-stays F] [--ops N] [--seed N]
+class BenchmarkSuite {
+private:
+    SyntheticProfile profile;
+    vector<size_t> sizes;
+    size_t operations;
+    string json;
+    bool firstResult;
+
+    template <typename Body>
+    void measure(size_t rows, const char* name, size_t iterations, Body body) {
+        auto started = chrono::steady_clock::now();
+        body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        ostringstream entry;
+        entry << (firstResult ? "\n" : ",\n") << "    {\"rows\": " << rows << ", \"name\": \"" << name
+              << "\", \"iterations\": " << iterations << ", \"total_ms\": " << fixed << setprecision(3)
+              << seconds * 1000 << ", \"per_op_us\": " << seconds * 1e6 / max<size_t>(1, iterations)
+              << ", \"ops_per_sec\": " << setprecision(0) << (seconds > 0 ? iterations / seconds : 0) << "}";
+        json += entry.str();
+        firstResult = false;
+        cerr << rows << " rows: " << name << " " << fixed << setprecision(1) << seconds * 1000 << " ms" << endl;
+    }
+
+    static string writeSyntheticFile(const SyntheticProfile& profile) {
+        string path = "hms_bench_" + to_string(profile.rows) + ".csv";
+        AtomicFile file(path);
+        SyntheticHospital hospital(profile);
+        string buffer = "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+        for (size_t i = 0; i < profile.rows; i++) {
+            hospital.next().appendCSV(buffer);
+            buffer += '\n';
+            if (buffer.size() >= (1 << 20)) {
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), buffer.size());
+        file.commit();
+        return path;
+    }
+
+    void runSize(size_t rows) {
+        SyntheticProfile sized = profile;
+        sized.rows = rows;
+        string csvPath = writeSyntheticFile(sized);
+        string snapshotPath = csvPath.substr(0, csvPath.size() - 4) + ".hms";
+        ostream quiet(nullptr);
+        size_t ops = min(operations, rows);
+        uint32_t state = 12345;
+        auto random = [&state]() { state = state * 1664525u + 1013904223u; return state >> 8; };
+        {
+            unique_ptr<HospitalSystem> hospital;
+            measure(rows, "load_csv", rows, [&] { hospital.reset(new HospitalSystem(csvPath, quiet)); });
+            measure(rows, "save_csv", rows, [&] { hospital->writeCSV(csvPath); });
+            measure(rows, "save_snapshot", rows, [&] { hospital->writeSnapshot(snapshotPath); });
+        }
+        unique_ptr<HospitalSystem> hospital;
+        measure(rows, "load_snapshot", rows, [&] { hospital.reset(new HospitalSystem(snapshotPath, quiet)); });
+
+        size_t found = 0;
+        measure(rows, "lookup_id", ops, [&] {
+            Patient patient;
+            for (size_t i = 0; i < ops; i++) found += hospital->getPatient(1 + random() % rows, patient);
+        });
+        measure(rows, "lookup_name", ops, [&] {
+            for (size_t i = 0; i < ops; i++) {
+                string name = string(SyntheticHospital::firstName(random())) + " " + SyntheticHospital::lastName(random());
+                found += hospital->findByNameContaining(name).size();
+            }
+        });
+        measure(rows, "lookup_admission_date", ops, [&] {
+            for (size_t i = 0; i < ops; i++) {
+                found += hospital->admittedOn(Date(1, 1, 2015).addDays(random() % sized.spanDays)).size();
+            }
+        });
+        measure(rows, "query_department_room", ops, [&] {
+            for (size_t i = 0; i < ops; i++) {
+                PatientQuery query;
+                query.terms.push_back(QueryPredicate::departmentIs(
+                    SyntheticHospital::departmentName(random() % sized.departments)));
+                query.terms.push_back(QueryPredicate::roomIs(1 + random() % sized.rooms));
+                found += hospital->runQuery(query).size();
+            }
+        });
+        measure(rows, "statistics", 1, [&] { found += hospital->statisticsOn(Date(1, 6, 2020)).census.admitted; });
+
+        string error;
+        measure(rows, "add", ops, [&] {
+            SyntheticHospital extra(sized);
+            for (size_t i = 0; i < ops; i++) {
+                Patient patient = extra.next();
+                patient.id = 0;
+                found += hospital->admitPatient(patient, error) > 0;
+            }
+        });
+        measure(rows, "update", ops, [&] {
+            Patient patient;
+            for (size_t i = 0; i < ops; i++) {
+                if (!hospital->getPatient(1 + random() % rows, patient)) continue;
+                patient.roomNumber = 1 + random() % sized.rooms;
+                found += hospital->updatePatientRecord(patient, error);
+            }
+        });
+        measure(rows, "delete", ops, [&] {
+            for (size_t i = 0; i < ops; i++) found += hospital->removePatient(1 + random() % rows);
+        });
+        hospital.reset();
+        cerr << rows << " rows: checksum " << found << endl;
+
+        remove(csvPath.c_str());
+        remove((csvPath + ".journal").c_str());
+        remove(snapshotPath.c_str());
+        remove((snapshotPath + ".journal").c_str());
+    }
+
+public:
+    BenchmarkSuite() : sizes({10000, 100000, 1000000}), operations(10000), firstResult(true) {}
+
+    // Returns false on an unknown option or a missing value.
+    bool configure(const vector<string>& args) {
+        for (size_t i = 0; i < args.size(); i++) {
+            if (i + 1 >= args.size()) return false;
+            const string& option = args[i];
+            const string& value = args[++i];
+            if (option == "--rows") {
+                sizes.clear();
+                stringstream list(value);
+                string item;
+                while (getline(list, item, ',')) sizes.push_back(strtoull(item.c_str(), nullptr, 10));
+            } else if (option == "--departments") {
+                profile.departments = max(1, atoi(value.c_str()));
+            } else if (option == "--conditions") {
+                profile.conditions = max(1, atoi(value.c_str()));
+            } else if (option == "--skew") {
+                profile.skew = atof(value.c_str());
+            } else if (option == "--stay-days") {
+                profile.meanStayDays = max(1, atoi(value.c_str()));
+            } else if (option == "--rooms") {
+                profile.rooms = max(1, atoi(value.c_str()));
+            } else if (option == "--open-stays") {
+                profile.openStayFraction = atof(value.c_str());
+            } else if (option == "--ops") {
+                operations = strtoull(value.c_str(), nullptr, 10);
+            } else if (option == "--seed") {
+                profile.seed = static_cast<unsigned>(strtoul(value.c_str(), nullptr, 10));
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int run() {
+        for (size_t rows : sizes) {
+            if (rows > 0) runSize(rows);
+        }
+        cout << "{\n  \"profile\": {\"departments\": " << profile.departments << ", \"conditions\": "
+             << profile.conditions << ", \"skew\": " << profile.skew << ", \"mean_stay_days\": "
+             << profile.meanStayDays << ", \"rooms\": " << profile.rooms << ", \"open_stay_fraction\": "
+             << profile.openStayFraction << ", \"seed\": " << profile.seed << ", \"ops\": " << operations
+             << ", \"threads\": " << sharedWorkerPool().size() << "},\n  \"results\": [" << json << "\n  ]\n}\n";
+        return 0;
+    }
+};
+
+// Line-oriented request protocol over the thread-safe API. One request per
+// line, verb first (case-insensitive); patient rows use the CSV column order.
+//   PING
+//   GET <id>
+//   FIND <query>              same syntax as the Advanced Query menu
+//   ADD <csv row>             id 0 assigns the next free id
+//   UPDATE <csv row>
+//   DELETE <id>
+//   STATS [DD-MM-YYYY]        census for the day, today by default
+//   CENSUS DATE[..DATE]       patients,N / rooms,N / department,NAME,N for one
+//                             day, or DATE,patients,rooms per day of a range
+//   STAYS [DATE..DATE]        group,name,admissions,discharges,stays,mean_days,
+//                             p50_days,p90_days,p99_days,max_days,turnover per
+//                             group, over the full history by default
+//   PERF [RESET]              op,count,mean_us,p50_us,p90_us,p99_us,max_us per operation
+//   QUIT
+// Every response is "OK <n>" followed by n lines, or a single "ERR <message>".
+class RequestProtocol {
+private:
+    HospitalSystem& hospital;
+
+    static void fail(string& out, const string& message) {
+        out += "ERR ";
+        out += message;
+        out += '\n';
+    }
+
+    static void succeed(string& out, size_t lines) {
+        out += "OK ";
+        appendInt(out, static_cast<long long>(lines));
+        out += '\n';
+    }
+
+    static void appendRows(string& out, const vector<Patient>& rows) {
+        succeed(out, rows.size());
+        for (const Patient& patient : rows) {
+            patient.appendCSV(out);
+            out += '\n';
         }
-        
-        while (true) {
-            cout << "Enter medical history (max 200 characters): ";
-            getline(cin, medHistory);
-            if (medHistory.length() <= 200) {
-                break;
-            }
-            cout << "Error: Medical history must be less than 200 characters\n";
+    }
+
+    bool parsePatient(const string& text, Patient& patient, string& out) {
+        vector<Patient> parsed;
+        if (HospitalSystem::parseRecord(StrRef(text.data(), text.size()), parsed) != HospitalSystem::RecordParsed) {
+            fail(out, "Expected ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber");
+            return false;
         }
-        
-        cout << "\nAvailable departments:\n";
-        for (const auto& dept : departmentToIndices) {
-            cout << "- " << dept.first << " (" << dept.second.size() << " patients)\n";
+        patient = parsed[0];
+        return true;
+    }
+
+    static bool parseId(const string& text, int& id) {
+        return parseInt(StrRef(text.data(), text.size()), id);
+    }
+
+public:
+    explicit RequestProtocol(HospitalSystem& hospital)
+        : hospital(hospital) {}
+
+    // Appends the response for one request line to out. Returns false if
+    // the client asked to close the connection.
+    bool handle(const string& line, string& out) {
+        size_t space = line.find(' ');
+        string verb = foldCase(line.substr(0, space));
+        string argument = space == string::npos ? "" : line.substr(space + 1);
+        if (!argument.empty() && argument[argument.size() - 1] == '\r') {
+            argument.erase(argument.size() - 1);
         }
-        
-        while (true) {
-            cout << "\nEnter department (select from the list above): ";
-            getline(cin, department);
-            
-            bool isValid = false;
-            for (const auto& dept : departmentToIndices) {
-                if (dept.first == department) {
-                    isValid = true;
-                    break;
-                }
+        if (!verb.empty() && verb[verb.size() - 1] == '\r') {
+            verb.erase(verb.size() - 1);
+        }
+
+        string error;
+        if (verb == "ping") {
+            succeed(out, 0);
+        } else if (verb == "get") {
+            int id;
+            Patient patient;
+            if (!parseId(argument, id)) {
+                fail(out, "Expected GET <id>");
+            } else if (!hospital.getPatient(id, patient)) {
+                fail(out, "Patient not found.");
+            } else {
+                appendRows(out, vector<Patient>(1, patient));
             }
-            
-            if (isValid) {
-                break;
+        } else if (verb == "find") {
+            PatientQuery query;
+            if (!PatientQuery::parse(argument, query, error)) {
+                fail(out, error);
+            } else {
+                appendRows(out, hospital.queryPatients(query));
             }
-            cout << "Error: Invalid department. Please select from the list above.\n";
-        }
-        
-        while (true) {
-            cout << "Enter condition (2-100 characters): ";
-            getline(cin, condition);
-            if (condition.length() >= 2 && condition.length() <= 100) {
-                break;
+        } else if (verb == "add") {
+            Patient patient;
+            if (parsePatient(argument, patient, out)) {
+                int id = hospital.admitPatient(patient, error);
+                if (id < 0) {
+                    fail(out, error);
+                } else {
+                    patient.id = id;
+                    appendRows(out, vector<Patient>(1, patient));
+                }
             }
-            cout << "Error: Condition must be between 2 and 100 characters\n";
-        }
-        
-        while (true) {
-            cout << "Enter admission date (DD-MM-YYYY): ";
-            getline(cin, admissionDateStr);
-            try {
-                Date admissionDate(admissionDateStr);
-                if (admissionDate < Date()) {
-                    throw invalid_argument("Admission date cannot be in the past");
+        } else if (verb == "update") {
+            Patient patient;
+            if (parsePatient(argument, patient, out)) {
+                if (hospital.updatePatientRecord(patient, error)) {
+                    succeed(out, 0);
+                } else {
+                    fail(out, error);
                 }
-                break;
-            } catch (const invalid_argument& e) {
-                cout << "Error: " << e.what() << "\n";
             }
-        }
-        
-        while (true) {
-            cout << "Enter discharge date (DD-MM-YYYY, leave empty if not discharged): ";
-            getline(cin, dischargeDateStr);
-            
-            if (dischargeDateStr.empty()) {
-                break;
+        } else if (verb == "delete") {
+            int id;
+            if (!parseId(argument, id)) {
+                fail(out, "Expected DELETE <id>");
+            } else if (!hospital.removePatient(id)) {
+                fail(out, "Patient not found.");
+            } else {
+                succeed(out, 0);
             }
-            
+        } else if (verb == "stats") {
+            Date day = Date::today();
+            if (!argument.empty() && !Date::parse(StrRef(argument.data(), argument.size()), day)) {
+                fail(out, "Expected STATS [DD-MM-YYYY]");
+                return true;
+            }
+            StatisticsReport report = hospital.statisticsOn(day);
+            string body;
+            size_t lines = 3;
+            body += "total,";
+            appendInt(body, static_cast<long long>(report.total));
+            body += "\nadmitted,";
+            appendInt(body, static_cast<long long>(report.census.admitted));
+            body += "\ndischarged,";
+            appendInt(body, static_cast<long long>(report.census.discharged));
+            body += '\n';
+            for (size_t code = 0; code < report.departmentTotals.size(); code++) {
+                if (report.departmentTotals[code] == 0) continue;
+                body += "department," + hospital.departmentName(code) + ",";
+                appendInt(body, static_cast<long long>(report.departmentTotals[code]));
+                body += '\n';
+                lines++;
+            }
+            for (size_t code = 0; code < report.conditionTotals.size(); code++) {
+                if (report.conditionTotals[code] == 0) continue;
+                body += "condition," + hospital.conditionName(code) + ",";
+                appendInt(body, static_cast<long long>(report.conditionTotals[code]));
+                body += '\n';
+                lines++;
+            }
+            succeed(out, lines);
+            out += body;
+        } else if (verb == "census") {
+            Date from, to;
+            bool valid = false;
             try {
-                Date admissionDate(admissionDateStr);
-                Date dischargeDate(dischargeDateStr);
-                
-                if (dischargeDate < admissionDate) {
-                    throw invalid_argument("Discharge date cannot be before admission date");
-                }
-                break;
-            } catch (const invalid_argument& e) {
-                cout << "Error: " << e.what() << "\n";
+                valid = PatientQuery::parseDateRange(argument, from, to) && !(to < from) &&
+                        from.daysUntil(to) < HospitalSystem::maxSeriesDays;
+            } catch (const invalid_argument&) {
             }
-        }
-
-        cout << "\nAvailable Rooms (1-200):\n";
-        for (int i = 1; i <= 200; i++) {
-            // Check if room exists in roomToIndices
-            auto it = roomToIndices.find(i);
-            if (it == roomToIndices.end()) {
-                cout << "- Room " << i << ": Available (0 current patients)\n";
+            if (!valid) {
+                fail(out, "Expected CENSUS DD-MM-YYYY[..DD-MM-YYYY]");
+                return true;
+            }
+            string body;
+            size_t lines = 0;
+            if (from == to) {
+                DayCensus census = hospital.censusOn(from);
+                body += "patients,";
+                appendInt(body, census.patients);
+                body += "\nrooms,";
+                appendInt(body, census.occupiedRooms);
+                body += '\n';
+                lines = 2;
+                for (size_t code = 0; code < census.departments.size(); code++) {
+                    if (census.departments[code] == 0) continue;
+                    body += "department," + hospital.departmentName(code) + ",";
+                    appendInt(body, census.departments[code]);
+                    body += '\n';
+                    lines++;
+                }
             } else {
-                int currentPatients = 0;
-                for (int idx : it->second) {
-                    if (patients[idx].admissionDate.isValid() && 
-                        (!patients[idx].dischargeDate.isValid() || 
-                         (Date() < patients[idx].dischargeDate))) {
-                        currentPatients++;
-                    }
+                OccupancySeries series = hospital.occupancyBetween(from, to);
+                for (size_t day = 0; day < series.days; day++) {
+                    appendDate(body, from.addDays(static_cast<int>(day)));
+                    body += ',';
+                    appendInt(body, series.total[day]);
+                    body += ',';
+                    appendInt(body, series.occupiedRooms[day]);
+                    body += '\n';
                 }
-                
-                if (currentPatients == 0) {
-                    cout << "- Room " << i << ": Available (0 current patients)\n";
+                lines = series.days;
+            }
+            succeed(out, lines);
+            out += body;
+        } else if (verb == "stays") {
+            Date from, to;
+            bool valid = false;
+            try {
+                if (argument.empty()) {
+                    hospital.historySpan(from, to);
+                    valid = !from.isValid() || HospitalSystem::validStayWindow(from, to, 7);
                 } else {
-                    cout << "- Room " << i << ": Occupied (" 
-                         << currentPatients << " current patient(s), "
-                         << it->second.size() << " total assignment(s))\n";
-                }
-                
-                if (currentPatients > 1) {
-                    cout << "  WARNING: Room is overbooked!\n";
+                    valid = PatientQuery::parseDateRange(argument, from, to) &&
+                            HospitalSystem::validStayWindow(from, to, 7);
                 }
+            } catch (const invalid_argument&) {
             }
-        }
-        
-        while (true) {
-            cout << "\nEnter room number (1-200): ";
-            cin >> roomNumber;
-            
-            if (roomNumber < 1 || roomNumber > 200) {
-                cout << "\nError: Room number must be between 1 and 200\n";
-                system("pause");
-                continue;
+            if (!valid) {
+                fail(out, "Expected STAYS [DD-MM-YYYY..DD-MM-YYYY]");
+                return true;
             }
-            
-            if (isRoomAvailable(roomNumber)) {
-                break;
+            StayAnalytics analytics;
+            hospital.stayAnalyticsBetween(from, to, 7, analytics);
+            string body;
+            size_t lines = hospital.appendStaySummaryCSV(body, analytics, false);
+            succeed(out, lines);
+            out += body;
+        } else if (verb == "perf") {
+            if (foldCase(argument) == "reset") {
+                perfRegistry().reset();
+                succeed(out, 0);
+            } else {
+                string lines;
+                perfRegistry().appendCSV(lines);
+                succeed(out, static_cast<size_t>(count(lines.begin(), lines.end(), '\n')));
+                out += lines;
             }
-            cout << "\nError: Room " << roomNumber << " is currently occupied.\n";
-            cout << "Please select another room from the available list above.\n";
+        } else if (verb == "quit") {
+            succeed(out, 0);
+            return false;
+        } else if (verb.empty()) {
+            fail(out, "Empty request");
+        } else {
+            fail(out, "Unknown request '" + verb + "'");
         }
+        return true;
+    }
+};
 
-        try {
-            Patient tempPatient(nextPatientId, name, medHistory, department, 
-                               condition, admissionDateStr, dischargeDateStr, roomNumber);
-            
-            if (!isValidPatient(tempPatient)) {
-                cout << "\nError: Invalid patient data. Cannot add patient.\n";
-                cout << "Please check all fields and try again.\n";
+#ifdef __linux__
+// Single-threaded epoll loop serving RequestProtocol on a Unix domain
+// socket. Each readable connection has every complete line in its buffer
+// answered in order, so clients can pipeline requests; replies are queued
+// and written as the socket accepts them. A client that half-closes its
+// end still gets a reply to every request it sent before that. The loop
+// wakes at least once a second and rolls the dashboard and room occupancy
+// over to the new date after midnight, as the menu does before each screen.
+//   hospital_system --serve <data file> <socket path>
+class RequestServer {
+private:
+    struct Connection {
+        string input;
+        string output;
+        bool closing;      // stop handling requests; close once output is sent
+        bool peerClosed;   // the client will send nothing more
+
+        Connection() : closing(false), peerClosed(false) {}
+    };
+
+    static const size_t maxLineBytes = 1 << 20;
+
+    HospitalSystem& hospital;
+    RequestProtocol protocol;
+    int listener;
+    int poller;
+    unordered_map<int, Connection> connections;
+    ostream* statusOut;
+
+    // Set from the signal handler and from other threads; a lock-free
+    // atomic is safe for both, where volatile sig_atomic_t only covers the
+    // handler.
+    static atomic<int>& stopFlag() {
+        static atomic<int> flag(0);
+        return flag;
+    }
+
+    static void requestStop(int) {
+        stopFlag() = 1;
+    }
+
+    void watch(int fd, bool wantRead, bool wantWrite, int op) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = (wantRead ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) |
+                       (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.fd = fd;
+        epoll_ctl(poller, op, fd, &event);
+    }
+
+    void closeConnection(int fd) {
+        epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
+
+    void acceptClients() {
+        for (;;) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
                 return;
             }
+            connections[fd] = Connection();
+            watch(fd, true, false, EPOLL_CTL_ADD);
+        }
+    }
 
-            // Add patient to system
-            patients.emplace_back(nextPatientId, name, medHistory, department,
-                                 condition, admissionDateStr, dischargeDateStr, roomNumber);
-            
-            cout << "\nPatient added successfully!\n";
-            cout << "Patient ID: " << nextPatientId << "\n";
-            cout << "Room Number: " << roomNumber << "\n";
-            cout << "Department: " << department << "\n";
-            
-            nextPatientId++;
-            buildIndices();
-            saveToCSV();
-        } catch (const invalid_argument& e) {
-            cout << "\nError: " << e.what() << "\n";
-            cout << "Please try again with valid information.\n";
-            return;
+    void readRequests(int fd, Connection& connection) {
+        char buffer[1 << 16];
+        for (;;) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                connection.input.append(buffer, received);
+                continue;
+            }
+            if (received == 0) {
+                connection.peerClosed = true;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection.closing = true;
+            }
+            break;
         }
 
-        patients.emplace_back(nextPatientId, name, medHistory, department, 
-                             condition, admissionDateStr, dischargeDateStr, roomNumber);
-        
-        cout << "Patient added with ID: " << nextPatientId << endl;
-        nextPatientId++;
-        
-        buildIndices();
-        saveToCSV();
-    }
-    bool isValidPatient(const Patient& patient) const {
-       
-        auto it = idToIndex.find(patient.id);
-        if (it != idToIndex.end()) {
-            cout << "Error: Patient ID already exists.\n";
-            return false;
+        // requests that arrived with the end of the stream are still answered
+        size_t start = 0;
+        size_t newline;
+        while (!connection.closing && (newline = connection.input.find('\n', start)) != string::npos) {
+            if (!protocol.handle(connection.input.substr(start, newline - start), connection.output)) {
+                connection.closing = true;
+            }
+            start = newline + 1;
+        }
+        connection.input.erase(0, start);
+        if (connection.input.size() > maxLineBytes) {
+            connection.output += "ERR Request line too long\n";
+            connection.closing = true;
         }
+        if (connection.peerClosed) {
+            if (!connection.closing && !connection.input.empty()) {
+                protocol.handle(connection.input, connection.output);
+            }
+            connection.input.clear();
+            connection.closing = true;
+        }
+    }
 
-        
-        if (patient.id <= 0) {
-            cout << "Error: Invalid patient ID. ID must be a positive number.\n";
+    // Returns false once the connection has been closed.
+    bool writeReplies(int fd, Connection& connection) {
+        size_t sent = 0;
+        while (sent < connection.output.size()) {
+            ssize_t written = send(fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+            if (written > 0) {
+                sent += written;
+            } else if (written < 0 && errno == EINTR) {
+                continue;
+            } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                closeConnection(fd);
+                return false;
+            }
+        }
+        connection.output.erase(0, sent);
+        if (connection.output.empty() && connection.closing) {
+            closeConnection(fd);
             return false;
         }
+        watch(fd, !connection.peerClosed, !connection.output.empty(), EPOLL_CTL_MOD);
+        return true;
+    }
 
-        
-        if (patient.roomNumber <= 0) {
-            cout << "Error: Invalid room number.\n";
-            return false;
+public:
+    // "Serving on" and "Server stopped" go to status.
+    explicit RequestServer(HospitalSystem& hospital, ostream& status = cout)
+        : hospital(hospital), protocol(hospital), listener(-1), poller(-1), statusOut(&status) {}
+
+    ~RequestServer() {
+        for (auto& entry : connections) close(entry.first);
+        if (poller >= 0) close(poller);
+        if (listener >= 0) close(listener);
+    }
+
+    // Makes run() return within a second; safe to call from another thread.
+    static void stop() {
+        stopFlag() = 1;
+    }
+
+    // Serves until SIGINT, SIGTERM or stop(). Returns 0, or 1 if the socket
+    // could not be set up.
+    int run(const string& socketPath) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            cerr << "Socket path too long: " << socketPath << endl;
+            return 1;
         }
+        strcpy(address.sun_path, socketPath.c_str());
 
-        
-        if (patient.name.empty()) {
-            cout << "Error: Patient name cannot be empty.\n";
-            return false;
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(socketPath.c_str());
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, SOMAXCONN) != 0) {
+            cerr << "Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+            return 1;
         }
+        poller = epoll_create1(EPOLL_CLOEXEC);
+        watch(listener, true, false, EPOLL_CTL_ADD);
 
-        
-        if (!patient.admissionDate.isValid()) {
-            cout << "Error: Invalid admission date.\n";
-            return false;
+        stopFlag() = 0;
+        signal(SIGINT, requestStop);
+        signal(SIGTERM, requestStop);
+        *statusOut << "Serving on " << socketPath << endl;
+
+        epoll_event events[64];
+        while (!stopFlag()) {
+            int ready = epoll_wait(poller, events, 64, 1000);
+            hospital.refreshDay();
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listener) {
+                    acceptClients();
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                Connection& connection = it->second;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    readRequests(fd, connection);
+                }
+                writeReplies(fd, connection);
+            }
         }
+        unlink(socketPath.c_str());
+        *statusOut << "Server stopped" << endl;
+        return 0;
+    }
+};
+#endif
 
-        
-        if (patient.dischargeDate.isValid() && !(patient.admissionDate < patient.dischargeDate)) {
-            cout << "Error: Discharge date must be after admission date.\n";
-            return false;
+int serve(const string& dataFile, const string& socketPath) {
+#ifdef __linux__
+    try {
+        HospitalSystem hospital(dataFile);
+        RequestServer server(hospital);
+        return server.run(socketPath);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+#else
+    (void)dataFile;
+    (void)socketPath;
+    cerr << "Server mode is only available on Linux" << endl;
+    return 1;
+#endif
+}
+
+// Bulk-loads a CSV or NDJSON (.ndjson/.jsonl) admissions feed into a data
+// file and lists the rejected rows.
+//   hospital_system import <data file> <feed file>
+int ingestFile(const string& dataFile, const string& feedFile) {
+    try {
+        ifstream feed(feedFile.c_str(), ios::binary);
+        if (!feed) {
+            cerr << "Cannot open " << feedFile << endl;
+            return 1;
         }
+        size_t dot = feedFile.rfind('.');
+        string extension = dot == string::npos ? "" : foldCase(feedFile.substr(dot + 1));
+        IngestFormat format = extension == "ndjson" || extension == "jsonl" ? IngestNDJSON : IngestCSV;
 
-        return true;
+        HospitalSystem hospital(dataFile, cerr);
+        auto started = chrono::steady_clock::now();
+        IngestReport report = hospital.ingestStream(feed, format);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        for (const IngestReject& reject : report.rejects) {
+            cout << "Rejected line " << reject.row;
+            if (reject.id != 0) cout << " (ID " << reject.id << ")";
+            cout << ": " << reject.reason << endl;
+        }
+        cout << "Ingested " << report.accepted << " of " << report.accepted + report.rejects.size()
+             << " rows from " << feedFile << " in " << fixed << setprecision(1) << seconds * 1000 << " ms" << endl;
+        return report.rejects.empty() ? 0 : 2;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
     }
+}
 
-    void updatePatient() {
-        int id;
-        cout << "Enter patient ID to update: ";
-        cin >> id;
-        
-        
-        auto it = idToIndex.find(id);
-        if (it == idToIndex.end()) {
-            cout << "Patient with ID " << id << " not found." << endl;
-            return;
+// Converts between the CSV format and the binary snapshot format:
+//   hospital_system --to-snapshot patients.csv patients.hms
+//   hospital_system --to-csv patients.hms patients.csv
+int convertFile(const string& mode, const string& input, const string& output) {
+    try {
+        HospitalSystem hospital(input);
+        bool ok = mode == "--to-snapshot" ? hospital.writeSnapshot(output) : hospital.writeCSV(output);
+        if (!ok) {
+            cerr << "Error: Cannot write file: " << output << endl;
+            return 1;
         }
-        
-        Patient& patient = patients[it->second];
-        
-        int choice;
-        cout << "What do you want to update?\n"
-             << "1. Name\n"
-             << "2. Medical History\n"
-             << "3. Department\n"
-             << "4. Condition\n"
-             << "5. Admission Date\n"
-             << "6. Discharge Date\n"
-             << "7. Room Number\n"
-             << "Choice: ";
-        cin >> choice;
-        
-        cin.ignore();
-        string newValue;
-        
-        switch (choice) {
-            case 1:
-                cout << "Enter new name: ";
-                getline(cin, newValue);
-                patient.name = newValue;
-                break;
-            case 2:
-                cout << "Enter new medical history: ";
-                getline(cin, newValue);
-                patient.medicalHistory = newValue;
-                break;
-            case 3:
-                cout << "Enter new department: ";
-                getline(cin, newValue);
-                patient.department = newValue;
-                break;
-            case 4:
-                cout << "Enter new condition: ";
-                getline(cin, newValue);
-                patient.condition = newValue;
-                break;
-            case 5:
-                cout << "Enter new admission date (DD-MM-YYYY): ";
-                getline(cin, newValue);
-                patient.admissionDate = Date(newValue);
-                break;
-            case 6:
-                cout << "Enter new discharge date (DD-MM-YYYY): ";
-                getline(cin, newValue);
-                patient.dischargeDate = Date(newValue);
-                break;
-            case 7:
-                int newRoom;
-                cout << "Enter new room number: ";
-                cin >> newRoom;
-                patient.roomNumber = newRoom;
-                break;
-            default:
-                cout << "Invalid choice.\n";
-                return;
+        cout << "Wrote " << hospital.getPatientCount() << " patient records to " << output << endl;
+    } catch (const runtime_error& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// A single-id query against a snapshot with no journal to replay is
+// answered from the mapped file: one binary search over the id column and
+// one record built, without loading the rest or building indices. Returns
+// false when the query needs the full system.
+bool querySnapshot(const string& dataFile, const PatientQuery& query, OutputFormat format, ostream& out) {
+    if (query.terms.size() != 1 || query.terms[0].field != QueryId || query.terms[0].low != query.terms[0].high ||
+        !SnapshotReader::isSnapshot(dataFile)) {
+        return false;
+    }
+    ifstream journal(HospitalSystem::journalPathFor(dataFile).c_str(), ios::binary);
+    if (journal && journal.peek() != EOF) {
+        return false;
+    }
+    SnapshotReader reader;
+    if (!reader.open(dataFile)) {
+        return false;   // the full load reports the error
+    }
+    RecordWriter writer(out, format);
+    long long row = reader.findById(query.terms[0].low);
+    if (row >= 0) {
+        writer.write(reader.materialize(static_cast<uint32_t>(row)));
+    }
+    writer.flush();
+    return true;
+}
+
+// End-to-end checks run by --self-test. Each check works out its expected
+// answer without the code under test and prints one line. Scratch files are
+// created in the working directory and removed afterwards; load and replay
+// messages go to a buffer, so only the results reach the console.
+//   hospital_system --self-test
+class SelfTest {
+private:
+    string base;
+    vector<string> scratch;
+    ostringstream quiet;
+    int checks;
+    int failures;
+    unique_ptr<HospitalSystem> workload;
+    string workloadPath;
+    bool workloadApplied;
+
+    string scratchPath(const string& suffix) {
+        string path = base + suffix;
+        scratch.push_back(path);
+        return path;
+    }
+
+    template <typename Body>
+    void check(const char* name, Body body) {
+        bool passed = false;
+        try {
+            passed = body();
+        } catch (const exception& e) {
+            cout << "    " << e.what() << endl;
         }
-        
-        cout << "Patient updated successfully.\n";
-        buildIndices();
-        saveToCSV();
+        cout << "  " << name << ": " << (passed ? "ok" : "FAILED") << endl;
+        checks++;
+        failures += !passed;
     }
 
-    void deletePatient() {
-        int id;
-        cout << "Enter patient ID to delete: ";
-        cin >> id;
-        
-        
-        auto it = idToIndex.find(id);
-        if (it == idToIndex.end()) {
-            cout << "Patient with ID " << id << " not found." << endl;
-            return;
+    static void copyFile(const string& from, const string& to) {
+        ifstream in(from.c_str(), ios::binary);
+        ofstream out(to.c_str(), ios::binary);
+        out << in.rdbuf();
+    }
+
+    static vector<Patient> everyone(const HospitalSystem& hospital) {
+        PatientQuery query;
+        query.terms.push_back(QueryPredicate(QueryId));
+        query.terms[0].low = INT_MIN;
+        query.terms[0].high = INT_MAX;
+        return hospital.queryPatients(query);
+    }
+
+    static vector<string> rowsOf(const HospitalSystem& hospital) {
+        vector<string> rows;
+        for (const Patient& patient : everyone(hospital)) rows.push_back(patient.toCSV());
+        sort(rows.begin(), rows.end());
+        return rows;
+    }
+
+    static bool inHospital(const Patient& patient, const Date& day) {
+        return patient.admissionDate.isValid() && patient.admissionDate <= day &&
+               (!patient.dischargeDate.isValid() || day < patient.dischargeDate);
+    }
+
+    // A synthetic hospital after admissions (in 2030, after the synthetic
+    // history, some still open), edits and removals through the thread-safe
+    // API, shared by the checks below and built on first use.
+    HospitalSystem& workloadHospital() {
+        if (workload) {
+            return *workload;
         }
-        
-        patients.erase(patients.begin() + it->second);
-        cout << "Patient with ID " << id << " deleted successfully." << endl;
-        
-        buildIndices();
-        saveToCSV();
+        workloadPath = scratchPath(".csv");
+        SyntheticProfile profile;
+        profile.rows = 5000;
+        profile.seed = 11;
+        profile.openStayFraction = 0;
+        writeSyntheticCSV(workloadPath, profile);
+        workload.reset(new HospitalSystem(workloadPath, quiet));
+
+        string error;
+        workloadApplied = true;
+        for (int i = 0; i < 40; i++) {
+            Date admission = Date(1, 1, 2030).addDays(i);
+            Patient patient(0, "Journal " + to_string(i), "History", "Cardiology", "Stable", admission.toString(),
+                            admission.addDays(3).toString(), 1 + i);
+            workloadApplied = workloadApplied && workload->admitPatient(patient, error) > 0;
+        }
+        for (int i = 0; i < 5; i++) {
+            Patient patient(0, "Open " + to_string(i), "History", "Neurology", "Stable",
+                            Date(1, 3, 2030).addDays(i).toString(), "", 1 + 10 * i);
+            workloadApplied = workloadApplied && workload->admitPatient(patient, error) > 0;
+        }
+        for (int id = 1; id <= 20; id++) {
+            Patient patient;
+            workloadApplied = workloadApplied && workload->getPatient(id, patient);
+            patient.condition = "Improving";
+            workloadApplied = workloadApplied && workload->updatePatientRecord(patient, error);
+        }
+        for (int id = 101; id <= 120; id++) {
+            workloadApplied = workloadApplied && workload->removePatient(id);
+        }
+        return *workload;
     }
 
-    void searchById() {
-        cout << "\nEnter patient ID to search: ";
-        int id;
-        cin >> id;
-        
-        auto it = idToIndex.find(id);
-        if (it != idToIndex.end()) {
-            patients[it->second].display();
-        } else {
-            cout << "\nNo patient found with ID: " << id << "\n";
+    // The data file and journal copied while the system is live, plus a
+    // torn final journal record, load to the same records; so does a second
+    // copy taken after a record was written on top of the recovered journal.
+    bool journalReplay() {
+        HospitalSystem& hospital = workloadHospital();
+        string crashPath = scratchPath("_crash.csv");
+        string secondCrashPath = scratchPath("_crash2.csv");
+        copyFile(workloadPath, crashPath);
+        copyFile(workloadPath + ".journal", crashPath + ".journal");
+        {
+            ofstream journal((crashPath + ".journal").c_str(), ios::binary | ios::app);
+            journal << "A,99999,Torn";
         }
+        HospitalSystem recovered(crashPath, quiet);
+        bool replayed = rowsOf(recovered) == rowsOf(hospital) && recovered.verifyIndices();
+        string error;
+        Patient patient(0, "After Recovery", "History", "Surgery", "Stable", "01-03-2030", "04-03-2030", 50);
+        bool applied = workloadApplied && recovered.admitPatient(patient, error) > 0;
+        copyFile(crashPath, secondCrashPath);
+        copyFile(crashPath + ".journal", secondCrashPath + ".journal");
+        HospitalSystem again(secondCrashPath, quiet);
+        return applied && replayed && rowsOf(again) == rowsOf(recovered);
     }
 
-    void searchByName() {
-        string name;
-        cin.ignore();
-        cout << "Enter patient name (or partial name): ";
-        getline(cin, name);
-        
-        transform(name.begin(), name.end(), name.begin(), ::tolower);
-        
-        vector<int> results;
-        for (const auto& entry : nameToIndices) {
-            string entryNameLower = entry.first;
-            transform(entryNameLower.begin(), entryNameLower.end(), entryNameLower.begin(), ::tolower);
-            
-            if (entryNameLower.find(name) != string::npos) {
-                results.insert(results.end(), entry.second.begin(), entry.second.end());
-            }
+    // A binary snapshot reloads to the same records, single-id queries read
+    // straight from it match the loaded system, and the same file with one
+    // byte flipped in its string pool fails the checksum.
+    bool snapshotRoundTrip() {
+        HospitalSystem& hospital = workloadHospital();
+        string snapshotPath = scratchPath(".hms");
+        string corruptPath = scratchPath("_corrupt.hms");
+        if (!hospital.writeSnapshot(snapshotPath)) {
+            return false;
         }
-        
-        if (results.empty()) {
-            cout << "No patients found with name containing '" << name << "'." << endl;
-            return;
+        HospitalSystem reloaded(snapshotPath, quiet);
+        {
+            ifstream in(snapshotPath.c_str(), ios::binary);
+            string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            if (!bytes.empty()) bytes[bytes.size() - 1] ^= 0x20;
+            ofstream out(corruptPath.c_str(), ios::binary);
+            out << bytes;
         }
-        
-        cout << "Found " << results.size() << " patients:\n";
-        for (int idx : results) {
-            patients[idx].display();
+        bool lookups = true;
+        for (int id : {1, 110, 2500, 5000, 5040, 999999}) {
+            PatientQuery query;
+            query.terms.push_back(QueryPredicate::idIs(id));
+            ostringstream direct, loaded;
+            lookups = lookups && querySnapshot(snapshotPath, query, OutputNDJSON, direct);
+            {
+                RecordWriter writer(loaded, OutputNDJSON);
+                hospital.writeQueryResults(query, writer);
+            }
+            lookups = lookups && direct.str() == loaded.str();
         }
+        SnapshotReader corrupt;
+        return rowsOf(reloaded) == rowsOf(hospital) && reloaded.verifyIndices() && lookups &&
+               !corrupt.open(corruptPath) &&
+               corrupt.lastError() == "checksum mismatch";
     }
 
-    void searchByDateRange() {
-        cout << "\nEnter start date (DD-MM-YYYY): ";
-        string startDateStr;
-        cin.ignore();
-        getline(cin, startDateStr);
-        
-        cout << "\nEnter end date (DD-MM-YYYY): ";
-        string endDateStr;
-        getline(cin, endDateStr);
-        
-        try {
-            Date startDate(startDateStr);
-            Date endDate(endDateStr);
-            
-            cout << "\nPatients admitted between " << startDate.toString() << " and " << endDate.toString() << ":\n";
-            bool found = false;
-            
-            for (const auto& patient : patients) {
-                if (patient.admissionDate.isValid() && 
-                    !(startDate > patient.admissionDate) && 
-                    !(patient.admissionDate > endDate)) {
-                    patient.display();
-                    found = true;
-                }
+    static bool matches(const Patient& patient, const QueryPredicate& term) {
+        switch (term.field) {
+            case QueryId:
+                return patient.id >= term.low && patient.id <= term.high;
+            case QueryName:
+                return foldCase(patient.name).find(foldCase(term.text)) != string::npos;
+            case QueryDepartment:
+                return foldCase(patient.department) == foldCase(term.text);
+            case QueryCondition:
+                return foldCase(patient.condition) == foldCase(term.text);
+            case QueryRoom:
+                return patient.roomNumber >= term.low && patient.roomNumber <= term.high;
+            case QueryAdmitted:
+                return patient.admissionDate.isValid() && !(patient.admissionDate < term.from) &&
+                       !(term.to < patient.admissionDate);
+            case QueryDischarged:
+                return patient.dischargeDate.isValid() && !(patient.dischargeDate < term.from) &&
+                       !(term.to < patient.dischargeDate);
+            case QueryActive:
+                return inHospital(patient, term.from);
+        }
+        return false;
+    }
+
+    // The planner returns what a plain filter over every record does, for
+    // queries driven by each index and for residual checks on the columns
+    // (room-driven queries with a date term, including a discharge day).
+    bool queryPlanner() {
+        static const char* queries[] = {
+            "department=Cardiology", "condition=critical room=17", "name=smith", "name=an department=surgery",
+            "admitted=01-01-2016..31-03-2016", "discharged=01-06-2018..30-06-2018 department=Neurology",
+            "active=01-06-2017", "active=01-06-2017 condition=Stable", "room=5 or room=6",
+            "name=patel or department=ENT", "id=17", "id=110", "department=Nowhere",
+            "room=17 admitted=01-01-2016..31-12-2017", "room=42 discharged=01-01-2016..31-12-2016",
+            "room=17 active=01-06-2017", "room=17 active=20-01-2030"};
+        HospitalSystem& hospital = workloadHospital();
+        vector<Patient> all = everyone(hospital);
+        bool planned = true;
+        for (const char* text : queries) {
+            PatientQuery query;
+            string error;
+            if (!PatientQuery::parse(text, query, error)) {
+                cout << "    " << text << ": " << error << endl;
+                planned = false;
+                continue;
             }
-            
-            if (!found) {
-                cout << "\nNo patients found in the specified date range.\n";
+            vector<int> expected, found;
+            for (const Patient& patient : all) {
+                size_t hits = 0;
+                for (const QueryPredicate& term : query.terms) hits += matches(patient, term);
+                if (query.matchAny ? hits > 0 : hits == query.terms.size()) expected.push_back(patient.id);
+            }
+            for (const Patient& patient : hospital.queryPatients(query)) found.push_back(patient.id);
+            sort(expected.begin(), expected.end());
+            sort(found.begin(), found.end());
+            if (found != expected) {
+                cout << "    " << text << ": " << found.size() << " rows, expected " << expected.size() << endl;
+                planned = false;
             }
-        } catch (const invalid_argument& e) {
-            cout << "\nError: " << e.what() << "\n";
-            cout << "Please enter valid dates in DD-MM-YYYY format.\n";
         }
+        return planned;
     }
 
-    void showPatientsByDepartment() {
-        cout << "Available departments:\n";
-        for (const auto& dept : departmentToIndices) {
-            int activePatients = 0;
-            for (int idx : dept.second) {
-                if (!patients[idx].dischargeDate.isValid() || Date() < patients[idx].dischargeDate) {
-                    activePatients++;
-                }
+    // A data file with only the header line.
+    string emptyDataFile(const string& suffix) {
+        string path = scratchPath(suffix);
+        ofstream file(path.c_str(), ios::binary);
+        file << "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n";
+        return path;
+    }
+
+    // Every RequestProtocol verb on a small hospital, including ADD and
+    // UPDATE requests that overlap another stay or name a room out of range.
+    bool protocolVerbs() {
+        // request, expected start of the reply, text the reply must contain
+        static const char* script[][3] = {
+            {"PING", "OK 0", ""},
+            {"ADD 0,Ada Lovelace,Asthma,Cardiology,Stable,01-03-2024,10-03-2024,12", "OK 1", "\n1,Ada Lovelace,"},
+            {"ADD 0,Alan Turing,None,Surgery,Critical,05-03-2024,08-03-2024,12", "ERR", "occupied"},
+            {"ADD 0,Alan Turing,None,Surgery,Critical,05-03-2024,08-03-2024,201", "ERR", "between 1 and 200"},
+            {"ADD 0,Alan Turing,None,Surgery,Critical,05-03-2024,08-03-2024,13", "OK 1", "\n2,Alan Turing,"},
+            {"GET 2", "OK 1", "\n2,Alan Turing,None,Surgery,Critical,05-03-2024,08-03-2024,13\n"},
+            {"FIND department=cardiology", "OK 1", "\n1,Ada Lovelace,"},
+            {"UPDATE 2,Alan Turing,None,Surgery,Stable,05-03-2024,08-03-2024,13", "OK 0", ""},
+            {"UPDATE 2,Alan Turing,None,Surgery,Stable,05-03-2024,08-03-2024,12", "ERR", "occupied"},
+            {"CENSUS 06-03-2024", "OK 4", "\npatients,2\nrooms,2\n"},
+            {"CENSUS 01-03-2024..02-03-2024", "OK 2", "\n01-03-2024,1,1\n02-03-2024,1,1\n"},
+            {"STATS 06-03-2024", "OK", "\nadmitted,2\n"},
+            {"STAYS 01-03-2024..31-03-2024", "OK", "\nhospital,All,2,2,2,"},
+            {"DELETE 2", "OK 0", ""},
+            {"GET 2", "ERR", "not found"},
+            {"FIND bogus=1", "ERR", "Unknown field"},
+            {"FROB", "ERR", "Unknown request"},
+            {"QUIT", "OK 0", ""}};
+        const size_t steps = sizeof(script) / sizeof(script[0]);
+        HospitalSystem hospital(emptyDataFile("_protocol.csv"), quiet);
+        RequestProtocol protocol(hospital);
+        bool answered = true;
+        for (size_t step = 0; step < steps; step++) {
+            string reply;
+            bool more = protocol.handle(script[step][0], reply);
+            if (reply.compare(0, strlen(script[step][1]), script[step][1]) != 0 ||
+                reply.find(script[step][2]) == string::npos || more != (step + 1 < steps)) {
+                cout << "    " << script[step][0] << " -> " << reply.substr(0, reply.find('\n')) << endl;
+                answered = false;
             }
-            cout << "- " << dept.first << " (" << activePatients << " active patients)\n";
         }
-        
-        string department;
-        cin.ignore();
-        cout << "Enter department name: ";
-        getline(cin, department);
-        
-        auto it = departmentToIndices.find(department);
-        if (it != departmentToIndices.end()) {
-            if (it->second.empty()) {
-                cout << "\nNo patients found in department: " << department << "\n";
-                return;
+        return answered && hospital.verifyIndices();
+    }
+
+    // A feed's rejected rows are exactly the malformed, out-of-range,
+    // overlapping (with a stored stay or an earlier row of the feed),
+    // backwards and duplicate-id ones; a stay starting on the day another
+    // in the same room ends is accepted.
+    bool ingestRejects() {
+        HospitalSystem hospital(emptyDataFile("_ingest.csv"), quiet);
+        string error;
+        Patient stored(0, "Ada Lovelace", "Asthma", "Cardiology", "Stable", "01-03-2024", "10-03-2024", 12);
+        if (hospital.admitPatient(stored, error) != 1) {
+            return false;
+        }
+        istringstream feed(
+            "ID,Name,MedicalHistory,Department,Condition,AdmissionDate,DischargeDate,RoomNumber\n"
+            "0,Grace Hopper,None,ENT,Stable,01-04-2024,05-04-2024,20\n"
+            "0,Short Row,None,ENT,Stable,01-04-2024\n"
+            "0,Room Over,None,ENT,Stable,01-04-2024,05-04-2024,201\n"
+            "0,Same Room,None,ENT,Stable,03-04-2024,06-04-2024,20\n"
+            "0,Old Stay,None,ENT,Stable,02-03-2024,04-03-2024,12\n"
+            "0,Backwards,None,ENT,Stable,05-04-2024,01-04-2024,21\n"
+            "1,Taken Id,None,ENT,Stable,01-05-2024,02-05-2024,30\n"
+            "0,Katherine Johnson,None,ENT,Stable,05-04-2024,09-04-2024,20\n");
+        IngestReport report = hospital.ingestStream(feed, IngestCSV);
+        vector<size_t> rejected;
+        for (const IngestReject& reject : report.rejects) rejected.push_back(reject.row);
+        return report.accepted == 2 && rejected == vector<size_t>({3, 4, 5, 6, 7, 8}) &&
+               hospital.patientCount() == 3 && hospital.verifyIndices();
+    }
+
+    // STATS (the dashboard for today, a column scan otherwise), CENSUS (the
+    // timeline and the room index) and a plain count over every record agree
+    // on who is in hospital, per department and per room.
+    bool censusAgreement() {
+        static const Date days[] = {Date(1, 1, 2015), Date(15, 6, 2017), Date(29, 2, 2020), Date(31, 12, 2024),
+                                    Date(2, 1, 2030), Date(3, 3, 2030), Date(1, 6, 2030), Date::today()};
+        HospitalSystem& hospital = workloadHospital();
+        vector<Patient> all = everyone(hospital);
+        bool agreed = true;
+        for (const Date& day : days) {
+            StatisticsReport report = hospital.statisticsOn(day);
+            DayCensus census = hospital.censusOn(day);
+            long long counted = 0;
+            set<int> rooms;
+            for (const Patient& patient : all) {
+                if (inHospital(patient, day)) {
+                    counted++;
+                    rooms.insert(patient.roomNumber);
+                }
             }
-            cout << "\nPatients in department " << department << ":\n";
-            for (int idx : it->second) {
-                patients[idx].display();
+            int occupied = 0;
+            for (size_t room = 1; room < report.census.roomOccupants.size(); room++) {
+                occupied += report.census.roomOccupants[room] > 0;
+            }
+            agreed = agreed && static_cast<long long>(report.census.admitted) == counted &&
+                     census.patients == counted && occupied == census.occupiedRooms &&
+                     census.occupiedRooms == static_cast<int>(rooms.size());
+            size_t codes = max(report.census.departmentAdmitted.size(), census.departments.size());
+            for (size_t code = 0; code < codes; code++) {
+                long long stats = code < report.census.departmentAdmitted.size()
+                    ? static_cast<long long>(report.census.departmentAdmitted[code]) : 0;
+                agreed = agreed && stats == (code < census.departments.size() ? census.departments[code] : 0);
             }
-        } else {
-            cout << "\nNo patients found in department: " << department << "\n";
         }
+        return agreed && hospital.verifyIndices();
     }
 
-    void showPatientsByCondition() {
-        cout << "Available conditions:\n";
-        for (const auto& cond : conditionToIndices) {
-            cout << "- " << cond.first << " (" << cond.second.size() << " patients)\n";
-        }
-        
-        string condition;
-        cin.ignore();
-        cout << "Enter condition: ";
-        getline(cin, condition);
-        
-        auto it = conditionToIndices.find(condition);
-        if (it != conditionToIndices.end()) {
-            if (it->second.empty()) {
-                cout << "\nNo patients found with condition: " << condition << "\n";
-                return;
-            }
-            cout << "\nPatients with condition " << condition << ":\n";
-            for (int idx : it->second) {
-                patients[idx].display();
+    // Stay analytics over a window match the sorted stay lengths of the
+    // records: counts, mean and max exactly, quantiles exactly below 16 days
+    // and within the 1/16 bucket width above.
+    bool stayQuantiles() {
+        HospitalSystem& hospital = workloadHospital();
+        Date from(1, 1, 2016), to(31, 12, 2020);
+        StayAnalytics analytics;
+        hospital.stayAnalyticsBetween(from, to, 7, analytics);
+        vector<uint64_t> lengths;
+        size_t admissions = 0;
+        for (const Patient& patient : everyone(hospital)) {
+            admissions += patient.admissionDate.isValid() && !(patient.admissionDate < from) &&
+                          !(to < patient.admissionDate);
+            if (patient.dischargeDate.isValid() && !(patient.dischargeDate < from) && !(to < patient.dischargeDate) &&
+                patient.admissionDate.isValid() && !(patient.dischargeDate < patient.admissionDate)) {
+                lengths.push_back(patient.admissionDate.daysUntil(patient.dischargeDate));
             }
-        } else {
-            cout << "\nNo patients found with condition: " << condition << "\n";
         }
+        if (lengths.empty()) {
+            return false;
+        }
+        sort(lengths.begin(), lengths.end());
+        double sum = 0;
+        for (uint64_t length : lengths) sum += length;
+        const StayStats& stays = analytics.hospital;
+        bool measured = stays.admissions == admissions && stays.discharges == lengths.size() &&
+                        stays.lengths.count() == lengths.size() && stays.lengths.max() == lengths.back() &&
+                        fabs(stays.lengths.mean() - sum / lengths.size()) < 1e-9 &&
+                        analytics.hospitalTurnover() == static_cast<double>(lengths.size()) / 200;
+        for (double q : {0.5, 0.9, 0.99, 1.0}) {
+            uint64_t exact = lengths[max<size_t>(1, static_cast<size_t>(ceil(q * lengths.size()))) - 1];
+            uint64_t reported = stays.lengths.percentile(q);
+            measured = measured && (exact < 16 ? reported == exact
+                                               : reported * 16 >= exact * 15 && reported * 16 <= exact * 17);
+        }
+        size_t byDepartment = 0;
+        for (const StayStats& group : analytics.departments) byDepartment += group.discharges;
+        return measured && byDepartment == stays.discharges;
     }
-    
-    void showPatientsByRoom() {
-        cout << "\nEnter room number: ";
-        int room;
-        cin >> room;
-        
-        if (room < 1 || room > 200) {
-            cout << "\nError: Room number must be between 1 and 200\n";
-            return;
+
+#ifdef __linux__
+    // Sends payload on a new connection to the server at socketPath, closes
+    // the sending side and returns everything received until the server
+    // closes the connection (at most about five seconds).
+    static string exchange(const string& socketPath, const string& payload) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return "";
         }
-        
-        auto it = roomToIndices.find(room);
-        if (it != roomToIndices.end()) {
-            if (it->second.empty()) {
-                cout << "\nNo patients found in room: " << room << "\n";
-                return;
-            }
-            cout << "\nPatients in room " << room << ":\n";
-            for (int idx : it->second) {
-                patients[idx].display();
+        timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        string reply;
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+            send(fd, payload.data(), payload.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(payload.size())) {
+            shutdown(fd, SHUT_WR);
+            char buffer[4096];
+            ssize_t received;
+            while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                reply.append(buffer, received);
             }
-        } else {
-            cout << "\nNo patients found in room: " << room << "\n";
-            cout << "Press any key to continue...\n";
-            system("pause");
         }
+        close(fd);
+        return reply;
     }
 
-    void displayAllPatients() {
-        if (patients.empty()) {
-            cout << "No patient records found.\n";
-            return;
+    // Clients that pipeline requests and then half-close get a reply to
+    // every request sent before the end of the stream, including a last
+    // one without a newline; QUIT still ends a connection early.
+    bool serverHalfClose() {
+        HospitalSystem hospital(emptyDataFile("_server.csv"), quiet);
+        string socketPath = scratchPath(".sock");
+        ostringstream status;
+        RequestServer server(hospital, status);
+        thread serving([&] { server.run(socketPath); });
+        bool listening = false;
+        for (int attempt = 0; attempt < 500 && !listening; attempt++) {
+            listening = exchange(socketPath, "PING\n") == "OK 0\n";
+            if (!listening) this_thread::sleep_for(chrono::milliseconds(10));
         }
-        
-        cout << "Total patients: " << patients.size() << endl;
-        for (const auto& patient : patients) {
-            patient.display();
+
+        string pings, expected;
+        for (int i = 0; i < 50; i++) {
+            pings += "PING\n";
+            expected += "OK 0\n";
+        }
+        bool answered = listening;
+        for (int client = 0; client < 20 && answered; client++) {
+            answered = exchange(socketPath, pings) == expected;
         }
+        answered = answered && exchange(socketPath, "PING\nPING") == "OK 0\nOK 0\n" &&
+                   exchange(socketPath, "PING\nQUIT\nPING\n") == "OK 0\nOK 0\n";
+        RequestServer::stop();
+        serving.join();
+        return answered;
     }
+#endif
 
-    void showStatistics() {
-        if (patients.empty()) {
-            cout << "No patient records found.\n";
-            return;
+    // Readers and writers on one SharedMutex never overlap a writer, and a
+    // HospitalSystem shared by reader and writer threads ends up with every
+    // write applied, its indices intact and no reader seeing a half-made
+    // record or a wrong query answer on the way.
+    bool concurrentAccess() {
+        SharedMutex lock;
+        atomic<int> reading(0), writing(0);
+        atomic<bool> overlapped(false);
+        vector<thread> threads;
+        for (int t = 0; t < 6; t++) {
+            threads.push_back(thread([&, t] {
+                for (int i = 0; i < 2000; i++) {
+                    if (t < 2) {
+                        lock_guard<SharedMutex> guard(lock);
+                        if (++writing != 1 || reading != 0) overlapped = true;
+                        this_thread::yield();
+                        writing--;
+                    } else {
+                        ReadLock guard(lock);
+                        reading++;
+                        if (writing != 0) overlapped = true;
+                        this_thread::yield();
+                        reading--;
+                    }
+                }
+            }));
         }
-        
-        cout << "\n=== Hospital Statistics ===\n";
-        cout << "Total patients: " << patients.size() << endl;
-        
-        // Count patients by department
-        cout << "\nPatients by Department:\n";
-        for (const auto& dept : departmentToIndices) {
-            cout << "- " << dept.first << ": " << dept.second.size() << endl;
+        for (thread& worker : threads) worker.join();
+        threads.clear();
+
+        const int initialRows = 2000, writers = 2, admissions = 200;
+        string path = scratchPath("_concurrent.csv");
+        SyntheticProfile profile;
+        profile.rows = initialRows;
+        profile.seed = 5;
+        profile.openStayFraction = 0;   // keeps every room free after the synthetic history
+        writeSyntheticCSV(path, profile);
+        HospitalSystem hospital(path, quiet);
+
+        atomic<int> writersLeft(writers), failed(0), admitted(0), removed(0);
+        for (int w = 0; w < writers; w++) {
+            threads.push_back(thread([&, w] {
+                string error;
+                for (int k = 0; k < admissions; k++) {
+                    // each writer owns rooms w*100+1..w*100+100; stays in one room never overlap
+                    Date admission = Date(1, 1, 2030).addDays(k / 100 * 5);
+                    string name = "Writer " + to_string(w) + " " + to_string(k);
+                    Patient patient(0, name, name, "Cardiology", "Stable", admission.toString(),
+                                    admission.addDays(3).toString(), w * 100 + 1 + k % 100);
+                    int id = hospital.admitPatient(patient, error);
+                    if (id < 0) {
+                        failed++;
+                        continue;
+                    }
+                    admitted++;
+                    patient.id = id;
+                    patient.name = patient.medicalHistory = name + " updated";
+                    if (!hospital.updatePatientRecord(patient, error)) failed++;
+                    if (k % 4 == 3) {
+                        if (hospital.removePatient(id)) removed++;
+                        else failed++;
+                    }
+                }
+                writersLeft--;
+            }));
         }
-        
-        // Count patients by condition
-        cout << "\nPatients by Condition:\n";
-        for (const auto& cond : conditionToIndices) {
-            cout << "- " << cond.first << ": " << cond.second.size() << endl;
+        for (int r = 0; r < 3; r++) {
+            threads.push_back(thread([&, r] {
+                uint32_t state = 2463534242u + r;
+                auto next = [&state]() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; };
+                while (writersLeft > 0) {
+                    Patient patient;
+                    int id = 1 + next() % (initialRows + writers * admissions);
+                    if (hospital.getPatient(id, patient) &&
+                        (patient.id != id || (id > initialRows && patient.name != patient.medicalHistory))) {
+                        failed++;
+                    }
+                    PatientQuery query;
+                    query.terms.push_back(QueryPredicate::nameContains("writer"));
+                    for (const Patient& match : hospital.queryPatients(query)) {
+                        if (match.name.compare(0, 7, "Writer ") != 0 || match.name != match.medicalHistory) failed++;
+                    }
+                    StatisticsReport report = hospital.statisticsOn(Date(2, 1, 2030));
+                    if (report.census.admitted + report.census.discharged != report.total) failed++;
+                    if (next() % 16 == 0 && !hospital.verifyIndices()) failed++;
+                }
+            }));
         }
-        
-        // Count currently admitted patients
-        int admittedCount = 0;
-        Date today("03-05-2025"); // Using today's date in DD-MM-YYYY format
-        
-        for (const auto& patient : patients) {
-            if (patient.admissionDate.isValid() && 
-                (!patient.dischargeDate.isValid() || today <= patient.dischargeDate)) {
-                admittedCount++;
+        for (thread& worker : threads) worker.join();
+
+        bool applied = admitted == writers * admissions &&
+                       static_cast<int>(hospital.patientCount()) == initialRows + admitted - removed;
+        for (int id = initialRows + 1; id <= initialRows + writers * admissions; id++) {
+            Patient patient;
+            bool kept = hospital.getPatient(id, patient);
+            applied = applied && (!kept || patient.name.find(" updated") != string::npos);
+        }
+        return !overlapped && failed == 0 && applied && hospital.verifyIndices();
+    }
+
+public:
+    SelfTest() : base("hms_selftest_" + to_string(time(nullptr))), checks(0), failures(0), workloadApplied(false) {}
+
+    int run() {
+        streambuf* console = cerr.rdbuf(quiet.rdbuf());
+        cout << "Self-test:" << endl;
+        check("concurrent readers and writers", [&] { return concurrentAccess(); });
+        check("journal replay after a crash", [&] { return journalReplay(); });
+        check("snapshot round trip and checksum", [&] { return snapshotRoundTrip(); });
+        check("query planner against a plain filter", [&] { return queryPlanner(); });
+        check("protocol verbs", [&] { return protocolVerbs(); });
+#ifdef __linux__
+        check("server replies before a half-close", [&] { return serverHalfClose(); });
+#endif
+        check("ingest rejects", [&] { return ingestRejects(); });
+        check("census and statistics agree", [&] { return censusAgreement(); });
+        check("stay quantiles against sorted lengths", [&] { return stayQuantiles(); });
+        workload.reset();
+        cerr.rdbuf(console);
+        for (const string& path : scratch) {
+            remove(path.c_str());
+            remove((path + ".journal").c_str());
+        }
+        cout << "Self-test: " << checks << " check(s), " << failures << " failure(s)" << endl;
+        return failures == 0 ? 0 : 1;
+    }
+};
+
+int selfTest() {
+    SelfTest test;
+    return test.run();
+}
+
+// Non-interactive front end. Results go to stdout and status lines to
+// stderr; the exit code is 0 on success, 1 on error and 2 when an import
+// rejected some rows.
+//   hospital_system load   <data file>            prints the load time and rows/sec
+//   hospital_system query  <data file> [--format csv|ndjson|table|record] <query...>
+//   hospital_system stats  <data file> [DD-MM-YYYY]
+//   hospital_system census <data file> <DD-MM-YYYY[..DD-MM-YYYY]> [--rooms]
+//   hospital_system stays  <data file> [DD-MM-YYYY..DD-MM-YYYY] [--by day|week] [--series]
+//   hospital_system import <data file> <feed.csv|feed.ndjson>
+//   hospital_system export <data file> <output.csv|output.hms>
+//   hospital_system batch  <data file> <script|->
+// A batch script holds one RequestProtocol request per line (blank lines
+// and lines starting with '#' are skipped); replies are written in order.
+void printUsage(ostream& out) {
+    out << "Usage:\n"
+        << "  hospital_system                                   interactive menu\n"
+        << "  hospital_system load   <data file>\n"
+        << "  hospital_system query  <data file> [--format csv|ndjson|table|record] <query...>\n"
+        << "  hospital_system stats  <data file> [DD-MM-YYYY]\n"
+        << "  hospital_system census <data file> <DD-MM-YYYY[..DD-MM-YYYY]> [--rooms]\n"
+        << "  hospital_system stays  <data file> [DD-MM-YYYY..DD-MM-YYYY] [--by day|week] [--series]\n"
+        << "  hospital_system import <data file> <feed.csv|feed.ndjson>\n"
+        << "  hospital_system export <data file> <output.csv|output.hms>\n"
+        << "  hospital_system batch  <data file> <script|->\n"
+        << "  hospital_system --serve <data file> <socket path>\n"
+        << "  hospital_system bench [--rows 10000,100000,1000000] [--departments N] [--conditions N]\n"
+        << "                        [--skew S] [--stay-days N] [--rooms N] [--open-stays F] [--ops N] [--seed N]\n"
+        << "  hospital_system --bench-columnar|--bench-statistics [rows...]\n"
+        << "  hospital_system --stress [readers] [writers] [seconds]\n"
+        << "  hospital_system --self-test\n";
+}
+
+int runCommand(const string& command, const vector<string>& args) {
+    static const char* commands[] = {"load", "query", "stats", "census", "stays", "import", "export", "batch"};
+    if (args.empty() || find(begin(commands), end(commands), command) == end(commands)) {
+        printUsage(cerr);
+        return 1;
+    }
+    try {
+        if (command == "import") {
+            if (args.size() != 2) {
+                printUsage(cerr);
+                return 1;
             }
+            return ingestFile(args[0], args[1]);
         }
-        
-        cout << "\nCurrently admitted patients: " << admittedCount << endl;
-        cout << "Discharged patients: " << (patients.size() - admittedCount) << endl;
-        
-        // Room utilization
-        cout << "\nRoom Utilization (1-200):\n";
-        for (int i = 1; i <= 200; i++) {
-            // Check if room exists in roomToIndices
-            auto it = roomToIndices.find(i);
-            if (it == roomToIndices.end()) {
-                cout << "- Room " << i << ": Available (0 current patients)\n";
+
+        OutputFormat format = OutputCSV;
+        PatientQuery query;
+        if (command == "query") {
+            size_t first = 1;
+            if (args.size() > 2 && args[1] == "--format") {
+                if (!parseOutputFormat(args[2], format)) {
+                    cerr << "Error: Unknown format: " << args[2] << endl;
+                    return 1;
+                }
+                first = 3;
+            }
+            string text;
+            for (size_t i = first; i < args.size(); i++) {
+                text += (i > first ? " " : "") + args[i];
+            }
+            string error;
+            if (!PatientQuery::parse(text, query, error)) {
+                cerr << "Error: " << error << endl;
+                return 1;
+            }
+            if (querySnapshot(args[0], query, format, cout)) {
+                return 0;
+            }
+        }
+
+        auto started = chrono::steady_clock::now();
+        HospitalSystem hospital(args[0], cerr);
+        if (command == "load") {
+            // load, journal replay and index build, before the check
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            if (!hospital.verifyIndices()) {
+                cerr << "Index check failed" << endl;
+                return 1;
+            }
+            size_t rows = hospital.patientCount();
+            cout << rows << " patient records in " << fixed << setprecision(1) << seconds * 1000 << " ms ("
+                 << static_cast<long long>(seconds > 0 ? rows / seconds : 0) << " rows/sec)" << endl;
+        } else if (command == "query") {
+            RecordWriter writer(cout, format);
+            hospital.writeQueryResults(query, writer);
+        } else if (command == "stats") {
+            Date day = Date::today();
+            if (args.size() > 1 && !Date::parse(StrRef(args[1].data(), args[1].size()), day)) {
+                cerr << "Error: Expected DD-MM-YYYY" << endl;
+                return 1;
+            }
+            hospital.printStatistics(hospital.statisticsOn(day), cout);
+        } else if (command == "census") {
+            Date from, to;
+            bool valid = false;
+            try {
+                valid = args.size() >= 2 && args.size() <= 3 && PatientQuery::parseDateRange(args[1], from, to) &&
+                        !(to < from) && from.daysUntil(to) < HospitalSystem::maxSeriesDays &&
+                        (args.size() == 2 || args[2] == "--rooms");
+            } catch (const invalid_argument&) {
+            }
+            if (!valid) {
+                cerr << "Error: Expected DD-MM-YYYY or DD-MM-YYYY..DD-MM-YYYY (at most "
+                     << HospitalSystem::maxSeriesDays << " days) and optionally --rooms" << endl;
+                return 1;
+            }
+            if (from == to && args.size() == 2) {
+                hospital.printCensus(hospital.censusOn(from), cout);
             } else {
-                int currentPatients = 0;
-                for (int idx : it->second) {
-                    if (patients[idx].admissionDate.isValid() && 
-                        (!patients[idx].dischargeDate.isValid() || today <= patients[idx].dischargeDate)) {
-                        currentPatients++;
+                string out;
+                hospital.appendOccupancyCSV(out, hospital.occupancyBetween(from, to), args.size() == 3);
+                cout << out;
+            }
+        } else if (command == "stays") {
+            Date from, to;
+            int periodDays = 7;
+            bool series = false;
+            bool valid = true;
+            try {
+                for (size_t i = 1; i < args.size() && valid; i++) {
+                    if (args[i] == "--series") {
+                        series = true;
+                    } else if (args[i] == "--by" && i + 1 < args.size() && (args[i + 1] == "day" || args[i + 1] == "week")) {
+                        periodDays = args[++i] == "day" ? 1 : 7;
+                    } else {
+                        valid = !from.isValid() && PatientQuery::parseDateRange(args[i], from, to);
                     }
                 }
-                
-                if (currentPatients == 0) {
-                    cout << "- Room " << i << ": Available (0 current patients)\n";
-                } else {
-                    cout << "- Room " << i << ": Occupied (" 
-                         << currentPatients << " current patient(s), "
-                         << it->second.size() << " total assignment(s))\n";
+            } catch (const invalid_argument&) {
+                valid = false;
+            }
+            if (valid && !from.isValid()) {
+                hospital.historySpan(from, to);
+                if (!from.isValid()) {
+                    cerr << "No admissions on record" << endl;
+                    return 0;
                 }
-                
-                if (currentPatients > 1) {
-                    cout << "  WARNING: Room is overbooked!\n";
+            }
+            if (!valid || !HospitalSystem::validStayWindow(from, to, periodDays)) {
+                cerr << "Error: Expected DD-MM-YYYY..DD-MM-YYYY (at most " << HospitalSystem::maxSeriesDays
+                     << " days or weeks), --by day|week and --series" << endl;
+                return 1;
+            }
+            StayAnalytics analytics;
+            hospital.stayAnalyticsBetween(from, to, periodDays, analytics);
+            string out;
+            if (series) {
+                hospital.appendStaySeriesCSV(out, analytics);
+            } else {
+                hospital.appendStaySummaryCSV(out, analytics, true);
+            }
+            cout << out;
+        } else if (command == "export") {
+            if (args.size() != 2) {
+                printUsage(cerr);
+                return 1;
+            }
+            const string& output = args[1];
+            bool snapshot = output.size() > 4 && foldCase(output.substr(output.size() - 4)) == ".hms";
+            if (!(snapshot ? hospital.writeSnapshot(output) : hospital.writeCSV(output))) {
+                cerr << "Error: Cannot write file: " << output << endl;
+                return 1;
+            }
+            cerr << "Wrote " << hospital.patientCount() << " patient records to " << output << endl;
+        } else if (command == "batch") {
+            if (args.size() != 2) {
+                printUsage(cerr);
+                return 1;
+            }
+            ifstream file;
+            if (args[1] != "-") {
+                file.open(args[1].c_str());
+                if (!file) {
+                    cerr << "Cannot open " << args[1] << endl;
+                    return 1;
+                }
+            }
+            istream& script = args[1] == "-" ? cin : file;
+            RequestProtocol protocol(hospital);
+            string line, reply;
+            bool failed = false;
+            while (getline(script, line)) {
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+                reply.clear();
+                bool more = protocol.handle(line, reply);
+                failed = failed || reply.compare(0, 3, "ERR") == 0;
+                cout << reply;
+                if (!more) {
+                    break;
                 }
             }
+            return failed ? 1 : 0;
         }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 4 && (string(argv[1]) == "--to-snapshot" || string(argv[1]) == "--to-csv")) {
+        return convertFile(argv[1], argv[2], argv[3]);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-columnar") {
+        vector<size_t> sizes;
+        for (int i = 2; i < argc; i++) sizes.push_back(strtoull(argv[i], nullptr, 10));
+        if (sizes.empty()) sizes = {1000000, 10000000};
+        return benchmarkColumnar(sizes);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-statistics") {
+        vector<size_t> sizes;
+        for (int i = 2; i < argc; i++) sizes.push_back(strtoull(argv[i], nullptr, 10));
+        if (sizes.empty()) sizes = {1000000, 10000000};
+        return benchmarkStatistics(sizes);
+    }
+    if (argc >= 2 && string(argv[1]) == "--stress") {
+        int readers = argc > 2 ? atoi(argv[2]) : 4;
+        int writers = argc > 3 ? atoi(argv[3]) : 2;
+        int seconds = argc > 4 ? atoi(argv[4]) : 5;
+        return stressTest(readers, writers, seconds);
+    }
+    if (argc == 2 && string(argv[1]) == "--self-test") {
+        return selfTest();
+    }
+    if (argc == 4 && string(argv[1]) == "--serve") {
+        return serve(argv[2], argv[3]);
+    }
+    if (argc >= 2) {
+        string command = argv[1];
+        if (command == "help" || command == "--help" || command == "-h") {
+            printUsage(cout);
+            return 0;
+        }
+        if (command == "bench") {
+            BenchmarkSuite suite;
+            if (!suite.configure(vector<string>(argv + 2, argv + argc))) {
+                printUsage(cerr);
+                return 1;
+            }
+            return suite.run();
+        }
+        return runCommand(command, vector<string>(argv + 2, argv + argc));
     }
-};
 
-int main() {
     // Welcome screen
     cout << "\n===================================\n";
     cout << "  Hospital Patient Record System\n";
@@ -874,6 +8223,7 @@ int main() {
             system("cls");
             
             // Display hospital statistics
+            hospital.refreshDay();
             cout << "\n=== Hospital Statistics ===\n";
             cout << "Total Patients: " << hospital.getPatientCount() << "\n";
             cout << "Available Rooms: " << hospital.getAvailableRooms() << "\n";
@@ -890,14 +8240,18 @@ int main() {
             cout << "9. Display Patients by Room\n";
             cout << "10. Display All Patients\n";
             cout << "11. Show Hospital Statistics\n";
+            cout << "12. Advanced Query\n";
+            cout << "13. Performance Counters\n";
+            cout << "14. Census History\n";
+            cout << "15. Length of Stay Analytics\n";
             cout << "0. Exit\n\n";
             
-            cout << "Enter your choice (0-11): ";
+            cout << "Enter your choice (0-15): ";
             cin >> choice;
             
             // Validate choice
-            if (choice < 0 || choice > 11) {
-                cout << "\nError: Invalid choice. Please enter a number between 0 and 11.\n";
+            if (choice < 0 || choice > 15) {
+                cout << "\nError: Invalid choice. Please enter a number between 0 and 15.\n";
                 system("pause");
                 continue;
             }
@@ -936,6 +8290,18 @@ int main() {
                 case 11:
                     hospital.showStatistics();
                     break;
+                case 12:
+                    hospital.advancedQuery();
+                    break;
+                case 13:
+                    hospital.showPerformance();
+                    break;
+                case 14:
+                    hospital.showCensus();
+                    break;
+                case 15:
+                    hospital.showStayAnalytics();
+                    break;
                 case 0:
                     cout << "\nThank you for using Hospital Management System!\n";
                     return 0;